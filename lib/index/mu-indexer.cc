@@ -63,6 +63,13 @@ private:
         State state_{Idle};
 };
 
+/// The progress counters, which the workers update concurrently.
+struct ProgressCounters {
+        void reset() { discovered = processed = updated = removed = 0; }
+
+        std::atomic<size_t> discovered{}, processed{}, updated{}, removed{};
+};
+
 struct Indexer::Private {
         Private (Mu::Store& store):
                 store_{store},
@@ -103,8 +110,8 @@ struct Indexer::Private {
 
         AsyncQueue<std::string> fq_;
 
-        Progress   progress_;
-        IndexState state_;
+        ProgressCounters progress_;
+        IndexState       state_;
 
         std::mutex lock_, wlock_;
 };
@@ -172,6 +179,7 @@ Indexer::Private::handler (const std::string& fullpath, struct stat *statbuf,
                 }
 
                 fq_.push(std::string{fullpath});
+                ++progress_.discovered;
                 return true;
         }
         default:
@@ -260,11 +268,11 @@ Indexer::Private::start(const Indexer::Config& conf)
                  conf_.scan ? "yes" : "no",
                  conf_.cleanup ? "yes" : "no");
 
+        progress_.reset();
         workers_.emplace_back(std::thread([this]{worker();}));
 
         state_.change_to(IndexState::Scanning);
         scanner_worker_ = std::thread([this]{
-                progress_ = {};
 
                 if (conf_.scan) {
                         g_debug("starting scanner");
@@ -366,8 +374,15 @@ Indexer::is_running() const
 Indexer::Progress
 Indexer::progress() const
 {
-        priv_->progress_.running =
-                priv_->state_ == IndexState::Idle ? false : true;
+        const auto& counters{priv_->progress_};
+
+        Progress progress;
+        progress.running    = !(priv_->state_ == IndexState::Idle);
+        progress.scanning   = priv_->state_ == IndexState::Scanning;
+        progress.discovered = counters.discovered;
+        progress.processed  = counters.processed;
+        progress.updated    = counters.updated;
+        progress.removed    = counters.removed;
 
-        return priv_->progress_;
+        return progress;
 }
@@ -88,10 +88,12 @@ public:
 
         // Object describing current progress
         struct Progress {
-                bool   running{};   /**< Is an index operation in progress? */
-                size_t processed{}; /**< Number of messages processed */
-                size_t updated{};   /**< Number of messages added/updated to store */
-                size_t removed{};   /**< Number of message removed from store */
+                bool   running{};    /**< Is an index operation in progress? */
+                bool   scanning{};   /**< Is the scanner still looking for messages? */
+                size_t discovered{}; /**< Number of messages the scanner queued (so far) */
+                size_t processed{};  /**< Number of messages processed */
+                size_t updated{};    /**< Number of messages added/updated to store */
+                size_t removed{};    /**< Number of message removed from store */
         };
 
         /**
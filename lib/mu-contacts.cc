@@ -20,8 +20,15 @@
 #include "mu-contacts.hh"
 
 #include <mutex>
+#include <atomic>
+#include <array>
 #include <unordered_map>
-#include <set>
+#include <unordered_set>
+#include <map>
+#include <cmath>
+#include <deque>
+#include <vector>
+#include <cstring>
 #include <sstream>
 #include <functional>
 #include <algorithm>
@@ -44,105 +51,340 @@ ContactInfo::ContactInfo (const std::string& _full_address,
         name{_name},
         personal{_personal},
         last_seen{_last_seen},
-        freq{_freq},
-        tstamp{g_get_monotonic_time()} {}
+        freq{_freq} {}
 
-struct EmailHash {
-        std::size_t operator()(const std::string& email) const {
-                std::size_t djb = 5381; // djb hash
-                for (const auto c : email)
-                        djb = ((djb << 5) + djb) + g_ascii_tolower(c);
-                return djb;
+// the e-mail address, normalized (i.e., lower-case), as we use it for finding
+// contacts; so we only need to do that once, not for every comparison.
+static std::string
+email_key (const std::string& email)
+{
+        std::string key{email};
+        for (auto& c: key)
+                c = g_ascii_tolower(c);
+
+        return key;
+}
+
+/*
+ * Contacts are ranked by their score: the sum, over all the messages where we
+ * saw them, of 2^((date - now) / half-life), i.e., each sighting counts for
+ * half as much when it is a half-life older.
+ *
+ * The score changes over time, but the _order_ does not, as all scores decay at
+ * the same rate. So we can leave out the 'now' part and keep log2 of the sum,
+ * i.e., log2(sum(2^(date / half-life))), which we can update incrementally for
+ * each new sighting, and which stays in a reasonable range.
+ */
+constexpr double ScoreHalfLife = 15 * 24 * 3600; // seconds
+
+// the score for freq sightings at last_seen (that's all we know for contacts from
+// older versions)
+static double
+initial_score (const ContactInfo& ci)
+{
+        return std::log2(static_cast<double>(std::max<std::size_t>(ci.freq, 1))) +
+                ci.last_seen / ScoreHalfLife;
+}
+
+// the score for the sightings of both scores, i.e., log2(2^score1 + 2^score2)
+static double
+add_scores (double score1, double score2)
+{
+        const auto high{std::max(score1, score2)}, low{std::min(score1, score2)};
+        return high + std::log2(1 + std::exp2(low - high));
+}
+
+struct ContactInfoLessThan {
+        bool operator()(const Mu::ContactInfo& ci1, const Mu::ContactInfo& ci2) const {
+
+                if (ci1.personal != ci2.personal)
+                        return ci1.personal; // personal comes first
+
+                if (ci1.score != ci2.score) // higher scores come first
+                        return ci1.score > ci2.score;
+
+                return g_ascii_strcasecmp(ci1.email.c_str(), ci2.email.c_str()) < 0;
+        }
+        bool operator()(const Mu::ContactInfo* ci1, const Mu::ContactInfo* ci2) const {
+                return (*this)(*ci1, *ci2);
         }
 };
 
-struct EmailEqual {
-        bool operator()(const std::string& email1, const std::string& email2) const {
-                return g_ascii_strcasecmp(email1.c_str(), email2.c_str()) == 0;
+
+constexpr std::size_t MinContactSlots = 64; // power of two
+
+/// The contacts, by their e-mail_key().
+///
+/// The contacts live in a deque, which allocates them in chunks rather than
+/// one-by-one, and where they stay put, so we can point to them. We find them
+/// through an open-addressing (linear probing) table. We never remove single
+/// contacts, only all of them at once, so this can be very simple.
+class ContactMap {
+public:
+        struct Entry {
+                std::string key;
+                ContactInfo ci;
+        };
+
+        ContactInfo* find (const std::string& key) const {
+                if (slots_.empty())
+                        return {};
+                const auto hash{std::hash<std::string>{}(key)};
+                for (auto idx = hash & mask(); slots_[idx].entry; idx = (idx + 1) & mask()) {
+                        const auto& slot{slots_[idx]};
+                        if (slot.hash == hash && slot.entry->key == key)
+                                return &slot.entry->ci;
+                }
+                return {};
         }
-};
 
-struct ContactInfoHash {
-        std::size_t operator()(const ContactInfo& ci) const {
-                std::size_t djb = 5381; // djb hash
-                for (const auto c : ci.email)
-                        djb = ((djb << 5) + djb) + g_ascii_tolower(c);
-                return djb;
+        // add a contact; there must not be one with the same key yet.
+        ContactInfo& add (std::string&& key, ContactInfo&& ci) {
+                if (2 * (entries_.size() + 1) > slots_.size())
+                        rehash(std::max<std::size_t>(MinContactSlots, 2 * slots_.size()));
+                const auto hash{std::hash<std::string>{}(key)};
+                entries_.push_back(Entry{std::move(key), std::move(ci)});
+                insert(hash, &entries_.back());
+                return entries_.back().ci;
         }
-};
 
-struct ContactInfoEqual {
-        bool operator()(const Mu::ContactInfo& ci1, const Mu::ContactInfo& ci2) const {
-                return g_ascii_strcasecmp(ci1.email.c_str(), ci2.email.c_str()) == 0;
+        void clear() {
+                entries_.clear();
+                slots_.clear();
         }
-};
 
-constexpr auto RecentOffset{15 * 24 * 3600};
-struct ContactInfoLessThan {
+        std::size_t size() const { return entries_.size(); }
 
-        ContactInfoLessThan(): recently_{::time({}) - RecentOffset} {}
+        std::deque<Entry>::iterator       begin()       { return entries_.begin(); }
+        std::deque<Entry>::iterator       end()         { return entries_.end(); }
+        std::deque<Entry>::const_iterator begin() const { return entries_.begin(); }
+        std::deque<Entry>::const_iterator end()   const { return entries_.end(); }
 
-        bool operator()(const Mu::ContactInfo& ci1, const Mu::ContactInfo& ci2) const {
+private:
+        struct Slot {
+                std::size_t hash;
+                Entry*      entry;
+        };
+        std::size_t mask() const { return slots_.size() - 1; }
 
-                if (ci1.personal != ci2.personal)
-                        return ci1.personal; // personal comes first
+        void insert (std::size_t hash, Entry* entry) {
+                auto idx{hash & mask()};
+                while (slots_[idx].entry)
+                        idx = (idx + 1) & mask();
+                slots_[idx] = Slot{hash, entry};
+        }
 
-                if ((ci1.last_seen > recently_) != (ci2.last_seen > recently_))
-                        return ci1.last_seen > ci2.last_seen;
+        void rehash (std::size_t size) {
+                std::vector<Slot> old(size, Slot{0, nullptr});
+                old.swap(slots_);
+                for (auto&& slot: old)
+                        if (slot.entry)
+                                insert(slot.hash, slot.entry);
+        }
 
-                if (ci1.freq != ci2.freq) // more frequent comes first
-                        return ci1.freq > ci2.freq;
+        std::deque<Entry> entries_;
+        std::vector<Slot> slots_;
+};
 
-                return g_ascii_strcasecmp(ci1.email.c_str(), ci2.email.c_str()) < 0;
-        }
-        // only sort recently seen contacts by recency; approx 15 days.
-        // this changes during the lifetime, but that's all fine.
-        const time_t recently_;
+using ContactPtrs = std::vector<const ContactInfo*>;
+using ChangeLog   = std::map<uint64_t, const ContactInfo*>; // seq -> contact
+
+/// An entry in the completion index: a word, which points into the flattened
+/// name / address of a contact, and runs until the end of it; and the rank of
+/// the contact, when we last ranked them.
+struct Completion {
+        const char*        word;
+        const ContactInfo* ci;
+        uint32_t           rank;
 };
+using Completions = std::vector<Completion>;
 
-using ContactUMap = std::unordered_map<const std::string, ContactInfo, EmailHash, EmailEqual>;
-//using ContactUSet = std::unordered_set<ContactInfo, ContactInfoHash, ContactInfoEqual>;
-using ContactSet  = std::set<std::reference_wrapper<const ContactInfo>, ContactInfoLessThan>;
+constexpr auto CompletionBlockSize = 64U;   // entries per block; see complete()
+constexpr auto MaxUnranked         = 1024U; // changed contacts before re-ranking
+
+constexpr auto PendingShardNum     = 16U;   // lock-stripes for add_pending()
+constexpr auto VerdictShardNum     = 16U;   // lock-stripes for the is_personal() cache
+constexpr auto MaxVerdicts         = 1024U; // cached verdicts per stripe
+
+using ContactUMap = std::unordered_map<std::string, ContactInfo>; // by e-mail_key()
+using EmailSet    = std::unordered_set<std::string>;              // e-mail_key()s
 
 struct Contacts::Private {
         Private(const std::string& serialized,
-                const StringVec& personal):
-                contacts_{deserialize(serialized)} {
+                const StringVec& personal) {
+                std::stringstream ss{serialized, std::ios_base::in};
+                std::string line;
+                while (getline (ss, line))
+                        deserialize(line);
+                make_change_log();
                 make_personal(personal);
         }
 
         void make_personal(const StringVec& personal);
-        ContactUMap deserialize(const std::string&) const;
-        std::string serialize() const;
+        void deserialize(const std::string& serialized);
+
+        void make_change_log();
+        void changed (ContactInfo& ci) {
+                if (ci.seq != 0)
+                        changes_.erase(ci.seq);
+                ci.seq = ++seq_;
+                changes_.emplace(ci.seq, &ci);
+                dirty_.emplace(&ci);
+        }
 
-        ContactUMap contacts_;
+        ContactInfo& add (std::string key, ContactInfo&& ci, std::size_t n);
+
+        ContactMap  contacts_;
+        ChangeLog   changes_; // the most recent change for each contact
+        uint64_t    seq_{};   // sequence number of the latest change
         std::mutex  mtx_;
 
-        StringVec               personal_plain_;
-        std::vector<std::regex> personal_rx_;
+        void update_ranking ();
+        ContactPtrs                            ranked_; // all contacts, by rank...
+        std::unordered_set<const ContactInfo*> rerank_; // ...except these (new / changed)
+
+        std::unordered_set<const ContactInfo*> dirty_;   // changed since last save
+        std::unordered_set<std::string>        removed_; // removed since last save
+
+        // contacts from add_pending(), not yet merged into contacts_; callers
+        // must hold mtx_ before touching contacts_, and merge them first.
+        struct PendingShard {
+                std::mutex  mtx;
+                ContactUMap pending;
+        };
+        std::array<PendingShard, PendingShardNum> shards_;
+        std::atomic<bool>                         has_pending_{};
+        void merge_pending ();
+        void clear_pending ();
+
+        void rank_changed (const ContactInfo& ci, bool is_new);
+        void update_completions ();
+        void rank_completions ();
+
+        using FlatStrs = std::unordered_map<const ContactInfo*, std::string>;
+        FlatStrs                flat_strs_;    // flattened name + address
+        Completions             completions_;  // sorted by word
+        std::vector<uint32_t>   block_ranks_;  // best rank in each block of completions_
+
+        std::unordered_set<const ContactInfo*> unindexed_; // new since last update
+        std::unordered_set<const ContactInfo*> unranked_;  // new or changed since then
+        bool                    completions_ok_{}; // if not, rebuild
+
+        EmailSet                personal_plain_;
+        std::vector<std::regex> personal_rx_; // combined, where possible
+
+        // cache of is_personal() verdicts for addresses that need the regexps;
+        // the same addresses come by again and again.
+        struct VerdictShard {
+                std::mutex                                                 mtx;
+                std::unordered_map<std::string, bool> verdicts; // by e-mail_key()
+        };
+        std::array<VerdictShard, VerdictShardNum> verdicts_;
 };
 
 constexpr auto Separator = "\xff"; // Invalid in UTF-8
 
+// find the ']' that ends the bracket expression starting at bre[pos]
+static std::size_t
+bracket_end (const std::string& bre, std::size_t pos)
+{
+        auto idx{pos + 1};
+        if (idx < bre.size() && bre[idx] == '^')
+                ++idx;
+        if (idx < bre.size() && bre[idx] == ']')
+                ++idx; // a literal ']'
+        for (; idx < bre.size() && bre[idx] != ']'; ++idx) {
+                if (bre[idx] == '[' && idx + 1 < bre.size() && bre[idx + 1] &&
+                    ::strchr(":.=", bre[idx + 1])) { // [:alpha:] etc.
+                        const auto end{bre.find(std::string{bre[idx + 1]} + ']', idx + 2)};
+                        if (end == std::string::npos)
+                                return std::string::npos;
+                        idx = end + 1;
+                }
+        }
+
+        return idx < bre.size() ? idx : std::string::npos;
+}
+
+// convert a basic regular expression (as std::regex reads them) into an
+// equivalent extended one, so we can combine it with others through '|'.
+// Returns false if we cannot, i.e., for back-references (the group numbers
+// change when combining), and for '^' / '$' other than at the start / end of
+// the pattern: whether those are anchors or literals in a basic regexp depends
+// on the implementation (e.g., libstdc++ takes them as anchors), so we leave
+// those to std::regex.
+static bool
+basic_to_extended (const std::string& bre, std::string& ere)
+{
+        ere.clear();
+        auto star_literal{true}; // would a '*' be a literal here?
+        for (std::size_t idx = 0; idx != bre.size(); ++idx) {
+                const auto kar{bre[idx]};
+                const auto at_start{star_literal};
+                star_literal = false;
+                if (kar == '\\' && idx + 1 < bre.size()) {
+                        const auto next{bre[++idx]};
+                        if (g_ascii_isdigit(next))
+                                return false;
+                        else if (next && ::strchr("(){}", next)) {
+                                ere += next;
+                                star_literal = next == '(';
+                        } else {
+                                ere += '\\';
+                                ere += next;
+                        }
+                } else if (kar == '[') {
+                        const auto end{bracket_end(bre, idx)};
+                        if (end == std::string::npos)
+                                return false;
+                        ere.append(bre, idx, end - idx + 1);
+                        idx = end;
+                } else if (kar == '^') {
+                        if (idx != 0)
+                                return false;
+                        ere += kar;
+                        star_literal = true;
+                } else if (kar == '$' && idx + 1 != bre.size()) {
+                        return false;
+                } else if ((kar == '*' && at_start) || // e.g. '*' at the start
+                           (kar && ::strchr("(){}|+?", kar))) { // literal in basic ones
+                        ere += '\\';
+                        ere += kar;
+                } else
+                        ere += kar;
+        }
+
+        return true;
+}
+
 void
 Contacts::Private::make_personal (const StringVec& personal)
 {
+        std::string combined; // the regexps we can combine into one.
+        const auto add_rx = [&](const std::string& rxstr, std::regex::flag_type syntax) {
+                personal_rx_.emplace_back(std::regex(rxstr, syntax |
+                                                     std::regex::optimize |
+                                                     std::regex::icase));
+        };
+
         for (auto&& p: personal)  {
 
                 if (p.empty())
                         continue; // invalid
 
                 if (p.size() < 2 || p.at(0) != '/' || p.at(p.length() - 1) != '/')
-                        personal_plain_.emplace_back(p); // normal address
+                        personal_plain_.emplace(email_key(p)); // normal address
                 else {
                         // a regex pattern.
+                        const auto rxstr{p.substr(1, p.length()-2)};
                         try {
-                                const auto rxstr{p.substr(1, p.length()-2)};
-                                personal_rx_.emplace_back(
-                                        std::regex(rxstr,
-                                                   std::regex::basic |
-                                                   std::regex::optimize |
-                                                   std::regex::icase));
+                                // check it by itself, so we can report errors.
+                                std::regex(rxstr, std::regex::basic);
+                                std::string ere;
+                                if (basic_to_extended(rxstr, ere))
+                                        combined += (combined.empty() ? "(" : "|(") + ere + ")";
+                                else
+                                        add_rx(rxstr, std::regex::basic);
 
                         } catch (const std::regex_error& rex) {
                                 g_warning ("invalid personal address regexp '%s': %s",
@@ -150,99 +392,402 @@ Contacts::Private::make_personal (const StringVec& personal)
                         }
                 }
         }
+
+        if (combined.empty())
+                return;
+
+        try {
+                add_rx(combined, std::regex::extended);
+        } catch (const std::regex_error& rex) { // should not happen, but...
+                g_warning ("cannot combine personal address regexps: %s", rex.what());
+                personal_rx_.clear();
+                for (auto&& p: personal)
+                        if (p.size() >= 2 && p.at(0) == '/' && p.at(p.length() - 1) == '/')
+                                try {
+                                        add_rx(p.substr(1, p.length() - 2), std::regex::basic);
+                                } catch (const std::regex_error&) {}
+        }
 }
 
-ContactUMap
-Contacts::Private::deserialize(const std::string& serialized) const
+static std::string
+serialize_contact (const ContactInfo& ci)
 {
-        ContactUMap contacts;
-        std::stringstream ss{serialized, std::ios_base::in};
-        std::string line;
+        char score[G_ASCII_DTOSTR_BUF_SIZE];
+
+        return Mu::format("%s%s"
+                          "%s%s"
+                          "%s%s"
+                          "%d%s"
+                          "%" G_GINT64_FORMAT "%s"
+                          "%" G_GINT64_FORMAT "%s"
+                          "%" G_GUINT64_FORMAT "%s"
+                          "%s",
+                          ci.full_address.c_str(), Separator,
+                          ci.email.c_str(), Separator,
+                          ci.name.c_str(), Separator,
+                          ci.personal ? 1 : 0, Separator,
+                          (gint64)ci.last_seen, Separator,
+                          (gint64)ci.freq, Separator,
+                          (guint64)ci.seq, Separator,
+                          g_ascii_dtostr(score, sizeof(score), ci.score));
+}
 
-        while (getline (ss, line)) {
+void
+Contacts::Private::deserialize(const std::string& serialized)
+{
+        // older versions do not have the sequence number and / or the score.
+        const auto parts = Mu::split (serialized, Separator);
+        if (G_UNLIKELY(parts.size() < 6 || parts.size() > 8)) {
+                g_warning ("error: '%s'", serialized.c_str());
+                return;
+        }
 
-                const auto parts = Mu::split (line, Separator);
-                if (G_UNLIKELY(parts.size() != 6)) {
-                        g_warning ("error: '%s'", line.c_str());
-                        continue;
+        ContactInfo ci(std::move(parts[0]), // full address
+                       parts[1], // email
+                       std::move(parts[2]), // name
+                       parts[3][0] == '1' ? true : false, // personal
+                       (time_t)g_ascii_strtoll(parts[4].c_str(), NULL, 10), // last_seen
+                       (std::size_t)g_ascii_strtoll(parts[5].c_str(), NULL, 10)); // freq
+        if (parts.size() >= 7)
+                ci.seq = g_ascii_strtoull(parts[6].c_str(), NULL, 10);
+        ci.score = parts.size() >= 8 ? g_ascii_strtod(parts[7].c_str(), NULL) :
+                initial_score(ci);
+
+        // replace existing contacts in-place, since the change log points
+        // to them.
+        auto key{email_key(parts[1])};
+        if (auto ci_existing = contacts_.find(key)) {
+                *ci_existing = std::move(ci);
+                rerank_.emplace(ci_existing);
+        } else
+                rerank_.emplace(&contacts_.add(std::move(key), std::move(ci)));
+}
+
+void
+Contacts::Private::make_change_log()
+{
+        changes_.clear();
+        for (auto&& entry: contacts_)
+                seq_ = std::max(seq_, entry.ci.seq);
+
+        // contacts from older versions do not have a sequence number yet; give
+        // them one.
+        for (auto&& entry: contacts_) {
+                auto& ci{entry.ci};
+                if (ci.seq == 0 || !changes_.emplace(ci.seq, &ci).second) {
+                        ci.seq = 0;
+                        changed(ci);
                 }
+        }
+}
 
-                ContactInfo ci(std::move(parts[0]), // full address
-                               parts[1], // email
-                               std::move(parts[2]), // name
-                               parts[3][0] == '1' ? true : false, // personal
-                               (time_t)g_ascii_strtoll(parts[4].c_str(), NULL, 10), // last_seen
-                               (std::size_t)g_ascii_strtoll(parts[5].c_str(), NULL, 10)); // freq
+static bool
+is_word_sepa (char c)
+{
+        return static_cast<unsigned char>(c) < 0x80 &&
+                (g_ascii_isspace(c) || g_ascii_ispunct(c));
+}
 
-                contacts.emplace(std::move(parts[1]), std::move(ci));
-        }
+// flatten the name and address of a contact; the newline keeps the words of the
+// name from running into the address.
+static std::string
+flatten (const ContactInfo& ci)
+{
+        return utf8_flatten(ci.name) + '\n' + utf8_flatten(ci.email);
+}
 
-        return contacts;
+template <typename Func> static void
+for_each_word (const std::string& flat, Func&& func)
+{
+        for (size_t i = 0; i != flat.size(); ++i)
+                if (!is_word_sepa(flat[i]) && (i == 0 || is_word_sepa(flat[i - 1])))
+                        func(flat.c_str() + i);
 }
 
+static bool
+word_less (const Completion& c1, const Completion& c2)
+{
+        return ::strcmp(c1.word, c2.word) < 0;
+}
 
-Contacts::Contacts (const std::string& serialized, const StringVec& personal) :
-        priv_{std::make_unique<Private>(serialized, personal)}
-{}
+// the contacts are kept in order of rank; after some have been added or
+// changed, we only need to sort those, and merge them with the others.
+void
+Contacts::Private::update_ranking ()
+{
+        if (rerank_.empty())
+                return;
+
+        const ContactInfoLessThan less;
+        if (rerank_.size() > ranked_.size() / 8) { // just sort all.
+                ranked_.clear();
+                ranked_.reserve(contacts_.size());
+                for (const auto& entry: contacts_)
+                        ranked_.emplace_back(&entry.ci);
+                std::sort(ranked_.begin(), ranked_.end(), less);
+        } else {
+                // a cheap pre-check, so we rarely need to look in rerank_
+                const auto bit = [](const ContactInfo* ci) {
+                        return uint64_t{1} << ((reinterpret_cast<uintptr_t>(ci) /
+                                                sizeof(ContactMap::Entry)) % 64);
+                };
+                uint64_t mask{};
+                for (auto&& ci: rerank_)
+                        mask |= bit(ci);
+                ranked_.erase(std::remove_if(ranked_.begin(), ranked_.end(),
+                                             [&](const ContactInfo* ci) {
+                                                     return (mask & bit(ci)) &&
+                                                             rerank_.find(ci) != rerank_.end();
+                                             }), ranked_.end());
+                const auto n{ranked_.size()};
+                ranked_.insert(ranked_.end(), rerank_.begin(), rerank_.end());
+                std::sort(ranked_.begin() + n, ranked_.end(), less);
+                std::inplace_merge(ranked_.begin(), ranked_.begin() + n, ranked_.end(), less);
+        }
 
-Contacts::~Contacts() = default;
+        rerank_.clear();
+}
 
-std::string
-Contacts::serialize() const
+// a contact was added / its rank may have changed.
+void
+Contacts::Private::rank_changed (const ContactInfo& ci, bool is_new)
 {
-        std::lock_guard<std::mutex> l_{priv_->mtx_};
-        std::string s;
+        if (!completions_ok_)
+                return; // we'll rebuild anyway.
 
-        for (auto& item: priv_->contacts_) {
-                const auto& ci{item.second};
-                s += Mu::format("%s%s"
-                                 "%s%s"
-                                 "%s%s"
-                                 "%d%s"
-                                 "%" G_GINT64_FORMAT "%s"
-                                 "%" G_GINT64_FORMAT "\n",
-                                 ci.full_address.c_str(), Separator,
-                                 ci.email.c_str(), Separator,
-                                 ci.name.c_str(), Separator,
-                                 ci.personal ? 1 : 0, Separator,
-                                 (gint64)ci.last_seen, Separator,
-                                 (gint64)ci.freq);
+        if (is_new) {
+                flat_strs_.emplace(&ci, flatten(ci));
+                unindexed_.emplace(&ci);
         }
+        unranked_.emplace(&ci);
+}
 
-        return s;
+void
+Contacts::Private::update_completions ()
+{
+        if (!completions_ok_) { // (re)build all
+                completions_.clear();
+                flat_strs_.clear();
+                for (auto&& entry: contacts_) {
+                        const auto& flat{flat_strs_.emplace(&entry.ci,
+                                                            flatten(entry.ci)).first->second};
+                        for_each_word(flat, [&](const char* word) {
+                                completions_.push_back({word, &entry.ci, 0});
+                        });
+                }
+                std::sort(completions_.begin(), completions_.end(), word_less);
+                unindexed_.clear();
+                rank_completions();
+                completions_ok_ = true;
+
+        } else if (unranked_.size() > MaxUnranked) {
+                // merge the words for the new contacts, and re-rank.
+                const auto n{completions_.size()};
+                for (auto&& ci: unindexed_)
+                        for_each_word(flat_strs_.at(ci), [&](const char* word) {
+                                completions_.push_back({word, ci, 0});
+                        });
+                std::sort(completions_.begin() + n, completions_.end(), word_less);
+                std::inplace_merge(completions_.begin(), completions_.begin() + n,
+                                   completions_.end(), word_less);
+                unindexed_.clear();
+                rank_completions();
+        }
 }
 
-const ContactInfo
-Contacts::add (ContactInfo&& ci)
+void
+Contacts::Private::rank_completions ()
 {
-        std::lock_guard<std::mutex> l_{priv_->mtx_};
+        update_ranking();
+
+        std::unordered_map<const ContactInfo*, uint32_t> ranks;
+        ranks.reserve(ranked_.size());
+        uint32_t rank{};
+        for (auto&& ci: ranked_)
+                ranks.emplace(ci, rank++);
+
+        block_ranks_.assign((completions_.size() + CompletionBlockSize - 1) /
+                            CompletionBlockSize, UINT32_MAX);
+        for (size_t idx = 0; idx != completions_.size(); ++idx) {
+                auto& c{completions_[idx]};
+                c.rank = ranks.at(c.ci);
+                auto& block_rank{block_ranks_[idx / CompletionBlockSize]};
+                block_rank = std::min(block_rank, c.rank);
+        }
 
-        auto it = priv_->contacts_.find(ci.email);
+        unranked_.clear();
+}
 
-        if (it == priv_->contacts_.end()) { // completely new contact
+// add a contact, seen n times.
+ContactInfo&
+Contacts::Private::add (std::string key, ContactInfo&& ci, std::size_t n)
+{
+        auto ci_found = contacts_.find(key);
+
+        if (!ci_found) { // completely new contact
 
                 ci.name         = Mu::remove_ctrl(ci.name);
                 ci.full_address = remove_ctrl(ci.full_address);
 
-                auto email{ci.email};
-                return priv_->contacts_.emplace(ContactUMap::value_type(email, std::move(ci))).first->second;
+                auto& ci_new{contacts_.add(std::move(key), std::move(ci))};
+                rerank_.emplace(&ci_new);
+                changed(ci_new);
+                rank_changed(ci_new, true/*new*/);
+                return ci_new;
 
         } else { // existing contact.
-                auto& ci_existing{it->second};
-                ++ci_existing.freq;
+                auto& ci_existing{*ci_found};
+                rerank_.emplace(&ci_existing);
+                ci_existing.freq += n;
+                ci_existing.score = add_scores(ci_existing.score, ci.score);
+                dirty_.emplace(&ci_existing);
+                rank_changed(ci_existing, false/*!new*/);
 
                 if (ci.last_seen > ci_existing.last_seen) { // update.
 
+                        auto name{Mu::remove_ctrl(ci.name)};
+                        if (name != ci_existing.name)
+                                completions_ok_ = false; // stale words
+
                         ci_existing.email        = std::move(ci.email);
-                        ci_existing.name         = Mu::remove_ctrl(ci.name);
+                        ci_existing.name         = std::move(name);
                         ci_existing.full_address = Mu::remove_ctrl(ci.full_address);
 
-                        ci_existing.tstamp       = g_get_monotonic_time();
                         ci_existing.last_seen    = ci.last_seen;
+                        changed(ci_existing);
                 }
 
-                return ci;
+                return ci_existing;
+        }
+}
+
+void
+Contacts::Private::merge_pending ()
+{
+        if (!has_pending_.exchange(false))
+                return;
+
+        for (auto&& shard: shards_) {
+                ContactUMap pending;
+                {
+                        std::lock_guard<std::mutex> l_{shard.mtx};
+                        pending.swap(shard.pending);
+                }
+                for (auto&& item: pending) {
+                        const auto n{item.second.freq};
+                        add(item.first, std::move(item.second), n);
+                }
+        }
+}
+
+void
+Contacts::Private::clear_pending ()
+{
+        for (auto&& shard: shards_) {
+                std::lock_guard<std::mutex> l_{shard.mtx};
+                shard.pending.clear();
+        }
+        has_pending_ = false;
+}
+
+void
+Contacts::load (const LoadFunc& load_func)
+{
+        std::lock_guard<std::mutex> l_{priv_->mtx_};
+
+        load_func([this](const std::string& serialized) {
+                priv_->deserialize(serialized);
+        });
+        priv_->make_change_log();
+        priv_->dirty_.clear(); // we just loaded them.
+        priv_->completions_ok_ = false;
+
+        priv_->merge_pending(); // these come after what we loaded.
+}
+
+std::size_t
+Contacts::save (const SaveFunc& save_func, bool all)
+{
+        std::lock_guard<std::mutex> l_{priv_->mtx_};
+        priv_->merge_pending();
+
+        for (auto&& email: priv_->removed_)
+                if (!priv_->contacts_.find(email_key(email)))
+                        save_func(email, {});
+        priv_->removed_.clear();
+
+        std::size_t n{};
+        if (all) {
+                for (auto&& entry: priv_->contacts_)
+                        save_func(entry.ci.email, serialize_contact(entry.ci));
+                n = priv_->contacts_.size();
+        } else {
+                for (auto&& ci: priv_->dirty_)
+                        save_func(ci->email, serialize_contact(*ci));
+                n = priv_->dirty_.size();
+        }
+        priv_->dirty_.clear();
+
+        return n;
+}
+
+Contacts::Contacts (const std::string& serialized, const StringVec& personal) :
+        priv_{std::make_unique<Private>(serialized, personal)}
+{}
+
+Contacts::~Contacts() = default;
+
+std::string
+Contacts::serialize() const
+{
+        std::lock_guard<std::mutex> l_{priv_->mtx_};
+        priv_->merge_pending();
+        std::string s;
+
+        for (auto& entry: priv_->contacts_) {
+                s += serialize_contact(entry.ci);
+                s += '\n';
+        }
+
+        return s;
+}
+
+const ContactInfo
+Contacts::add (ContactInfo&& ci)
+{
+        std::lock_guard<std::mutex> l_{priv_->mtx_};
+        priv_->merge_pending();
+
+        ci.score = initial_score(ci);
+        return priv_->add(email_key(ci.email), std::move(ci), 1);
+}
+
+void
+Contacts::add_pending (ContactInfo&& ci)
+{
+        auto key{email_key(ci.email)};
+        auto& shard{priv_->shards_[std::hash<std::string>{}(key) % PendingShardNum]};
+        {
+                std::lock_guard<std::mutex> l_{shard.mtx};
+
+                ci.score = initial_score(ci);
+                auto it = shard.pending.find(key);
+                if (it == shard.pending.end())
+                        shard.pending.emplace(std::move(key), std::move(ci));
+                else {
+                        auto& pending{it->second};
+                        pending.freq     += ci.freq;
+                        pending.score     = add_scores(pending.score, ci.score);
+                        pending.personal  = pending.personal || ci.personal;
+                        if (ci.last_seen > pending.last_seen) {
+                                pending.full_address = std::move(ci.full_address);
+                                pending.email        = std::move(ci.email);
+                                pending.name         = std::move(ci.name);
+                                pending.last_seen    = ci.last_seen;
+                        }
+                }
         }
+        priv_->has_pending_ = true;
 }
 
 
@@ -250,12 +795,9 @@ const ContactInfo*
 Contacts::_find (const std::string& email) const
 {
         std::lock_guard<std::mutex> l_{priv_->mtx_};
+        priv_->merge_pending();
 
-        const auto it = priv_->contacts_.find(email);
-        if (it == priv_->contacts_.end())
-                return {};
-        else
-                return &it->second;
+        return priv_->contacts_.find(email_key(email));
 }
 
 
@@ -264,7 +806,21 @@ Contacts::clear()
 {
         std::lock_guard<std::mutex> l_{priv_->mtx_};
 
+        for (auto&& entry: priv_->contacts_)
+                priv_->removed_.emplace(entry.ci.email);
+
+        priv_->clear_pending();
         priv_->contacts_.clear();
+        priv_->ranked_.clear();
+        priv_->rerank_.clear();
+        priv_->changes_.clear(); // but keep seq_ going.
+        priv_->dirty_.clear();
+
+        priv_->completions_.clear();
+        priv_->flat_strs_.clear();
+        priv_->unindexed_.clear();
+        priv_->unranked_.clear();
+        priv_->completions_ok_ = false;
 }
 
 
@@ -272,42 +828,226 @@ std::size_t
 Contacts::size() const
 {
         std::lock_guard<std::mutex> l_{priv_->mtx_};
+        priv_->merge_pending();
 
         return priv_->contacts_.size();
 }
 
 
 void
-Contacts::for_each(const EachContactFunc& each_contact) const
+Contacts::for_each(const EachContactFunc& each_contact, std::size_t maxnum) const
 {
         std::lock_guard<std::mutex> l_{priv_->mtx_};
+        priv_->merge_pending();
 
         if (!each_contact)
                 return; // nothing to do
 
-        // first sort them for 'rank'
-        ContactSet sorted;
-        for (const auto& item: priv_->contacts_)
-                sorted.emplace(item.second);
+        priv_->update_ranking();
+
+        std::size_t n{};
+        for (const auto ci: priv_->ranked_) {
+                if (maxnum != 0 && n++ == maxnum)
+                        break;
+                each_contact (*ci);
+        }
+}
+
+uint64_t
+Contacts::for_each_since (uint64_t seq, const EachRankedContactFunc& each_contact) const
+{
+        std::lock_guard<std::mutex> l_{priv_->mtx_};
+        priv_->merge_pending();
+
+        if (!each_contact)
+                return priv_->seq_; // nothing to do
+
+        // a sequence number from the future must be from some other (e.g.,
+        // re-created) store; so send everything.
+        if (seq > priv_->seq_)
+                seq = 0;
+
+        priv_->update_ranking();
+
+        // the contacts are in order of rank, so we only need to pick the ones
+        // that changed, until we have all of them.
+        auto changed_num = std::distance(priv_->changes_.upper_bound(seq),
+                                         priv_->changes_.end());
+        std::size_t rank{};
+        for (auto it = priv_->ranked_.begin(); changed_num != 0; ++it) {
+                ++rank;
+                if ((*it)->seq > seq) {
+                        each_contact(**it, rank);
+                        --changed_num;
+                }
+        }
+
+        return priv_->seq_;
+}
+
+/*
+ * The completion index has an entry for each word (i.e., the start of some
+ * word up to the end) in the names and addresses of the contacts, sorted by
+ * word; so the entries for some prefix are a contiguous range.
+ *
+ * For each entry, we remember the rank of its contact; and for each block of
+ * entries, the best rank in that block. So, to find the best matches, we visit
+ * the blocks in order of their best rank, until no unvisited block can have a
+ * better match than the ones we have; that way, we only need to visit a few of
+ * the blocks, even for short prefixes with many matches.
+ *
+ * Contacts that were added or changed since we last ranked them, we check
+ * separately.
+ */
+std::size_t
+Contacts::complete (const std::string& prefix, std::size_t maxnum,
+                    const EachContactFunc& each_contact, const ContactPredicate& pred) const
+{
+        std::lock_guard<std::mutex> l_{priv_->mtx_};
+        priv_->merge_pending();
+
+        if (!each_contact)
+                return 0; // nothing to do
+
+        priv_->update_completions();
+
+        const auto flat{utf8_flatten(prefix)};
+        const auto matches = [&](const char* word) {
+                return ::strncmp(word, flat.c_str(), flat.size()) == 0;
+        };
+
+        const auto& completions{priv_->completions_};
+        const auto& unranked{priv_->unranked_};
+        const auto lower = std::lower_bound(
+                completions.begin(), completions.end(), flat.c_str(),
+                [](const Completion& c, const char* word) { return ::strcmp(c.word, word) < 0; });
+        const auto upper = std::partition_point(
+                lower, completions.end(), [&](const Completion& c) { return matches(c.word); });
+
+        // the best matches we found so far, in order of rank.
+        std::vector<const Completion*> best;
+        const auto consider = [&](const Completion& c) {
+                if (maxnum != 0 && best.size() == maxnum && c.rank >= best.back()->rank)
+                        return; // not good enough
+                if (!unranked.empty() && unranked.find(c.ci) != unranked.end())
+                        return; // the rank is out of date; see below.
+                if (pred && !pred(*c.ci))
+                        return;
+                if (maxnum == 0) {
+                        best.emplace_back(&c);
+                        return;
+                }
+                const auto it = std::lower_bound(best.begin(), best.end(), &c,
+                                                 [](auto&& c1, auto&& c2) {
+                                                         return c1->rank < c2->rank; });
+                if (it != best.end() && (*it)->ci == c.ci)
+                        return; // already have it (through another word)
+                best.insert(it, &c);
+                if (best.size() > maxnum)
+                        best.pop_back();
+        };
+
+        const auto begin_idx{static_cast<size_t>(lower - completions.begin())};
+        const auto end_idx{static_cast<size_t>(upper - completions.begin())};
+        const auto first_block{(begin_idx + CompletionBlockSize - 1) / CompletionBlockSize};
+        const auto last_block{end_idx / CompletionBlockSize};
+
+        if (maxnum == 0 || first_block >= last_block) { // just check them all.
+                for (auto it = lower; it != upper; ++it)
+                        consider(*it);
+        } else {
+                // the partial blocks at either end
+                for (auto idx = begin_idx; idx != first_block * CompletionBlockSize; ++idx)
+                        consider(completions[idx]);
+                for (auto idx = last_block * CompletionBlockSize; idx != end_idx; ++idx)
+                        consider(completions[idx]);
+
+                // the full blocks, best first.
+                using BlockRank = std::pair<uint32_t, size_t>; // rank, block
+                std::vector<BlockRank> blocks;
+                blocks.reserve(last_block - first_block);
+                for (auto block = first_block; block != last_block; ++block)
+                        blocks.emplace_back(priv_->block_ranks_[block], block);
+                const auto worse = [](auto&& b1, auto&& b2) { return b1.first > b2.first; };
+                std::make_heap(blocks.begin(), blocks.end(), worse);
+
+                while (!blocks.empty()) {
+                        const auto block_rank{blocks.front()};
+                        if (best.size() == maxnum && block_rank.first >= best.back()->rank)
+                                break; // nothing better to find.
+                        std::pop_heap(blocks.begin(), blocks.end(), worse);
+                        blocks.pop_back();
+
+                        const auto idx{block_rank.second * CompletionBlockSize};
+                        for (auto i = idx; i != idx + CompletionBlockSize; ++i)
+                                consider(completions[i]);
+                }
+        }
+
+        ContactPtrs found;
+        for (auto&& c: best)
+                found.emplace_back(c->ci);
+        for (auto&& ci: unranked) {
+                if (pred && !pred(*ci))
+                        continue;
+                bool match{};
+                for_each_word(priv_->flat_strs_.at(ci), [&](const char* word) {
+                        match = match || matches(word);
+                });
+                if (match)
+                        found.emplace_back(ci);
+        }
+
+        std::sort(found.begin(), found.end(), ContactInfoLessThan{});
+        found.erase(std::unique(found.begin(), found.end()), found.end());
+        if (maxnum != 0 && found.size() > maxnum)
+                found.resize(maxnum);
 
-        for (const auto& ci: sorted)
-                each_contact (ci);
+        for (const auto ci: found)
+                each_contact(*ci);
+
+        return found.size();
+}
+
+uint64_t
+Contacts::seq() const
+{
+        std::lock_guard<std::mutex> l_{priv_->mtx_};
+        priv_->merge_pending();
+
+        return priv_->seq_;
 }
 
 bool
 Contacts::is_personal(const std::string& addr) const
 {
-        for (auto&& p: priv_->personal_plain_)
-                if (g_ascii_strcasecmp(addr.c_str(), p.c_str()) == 0)
-                        return true;
+        auto key{email_key(addr)};
+        if (priv_->personal_plain_.find(key) != priv_->personal_plain_.end())
+                return true;
+        if (priv_->personal_rx_.empty())
+                return false;
 
-        for (auto&& rx: priv_->personal_rx_) {
-                std::smatch m; // perhaps cache addr in personal_plain_?
-                if (std::regex_match(addr, m, rx))
-                        return true;
+        auto& shard{priv_->verdicts_[std::hash<std::string>{}(key) % VerdictShardNum]};
+        {
+                std::lock_guard<std::mutex> l_{shard.mtx};
+                const auto it = shard.verdicts.find(key);
+                if (it != shard.verdicts.end())
+                        return it->second;
         }
 
-        return false;
+        bool verdict{};
+        for (auto&& rx: priv_->personal_rx_)
+                if (std::regex_match(addr, rx)) {
+                        verdict = true;
+                        break;
+                }
+
+        std::lock_guard<std::mutex> l_{shard.mtx};
+        if (shard.verdicts.size() >= MaxVerdicts)
+                shard.verdicts.clear(); // keep it small.
+        shard.verdicts.emplace(std::move(key), verdict);
+
+        return verdict;
 }
 
 
@@ -317,6 +1057,8 @@ Contacts::is_personal(const std::string& addr) const
  *
  */
 
+#include <random>
+#include <thread>
 #include "test-mu-common.hh"
 
 static void
@@ -382,9 +1124,530 @@ test_mu_contacts_02()
         g_assert_false (contacts.is_personal("BÂr@CuuX.orG"));
         g_assert_false (contacts.is_personal("bar@fnorb.fi"));
         g_assert_false (contacts.is_personal("bar-zzz@fnorb.xr"));
+
+        // again, now from the cache.
+        g_assert_true (contacts.is_personal("bar-zzz@fnorb.fr"));
+        g_assert_true (contacts.is_personal("BAR-zzz@fnorb.fr"));
+        g_assert_false (contacts.is_personal("bar-zzz@fnorb.xr"));
 }
 
+static void
+test_mu_contacts_personal_rx()
+{
+        // the regexps are combined into one; check that gives the same
+        // verdicts as matching them one by one.
+        const Mu::StringVec rxs = {
+                "bar-.*@fnorb.f.",
+                "^a\\(b\\)*c@x\\.org$",
+                "d\\{2,3\\}@[[:alpha:]]*\\.com",
+                "(e+f?)|g@[]x-z]\\.net",
+                "xh*@[^^]*",
+                "\\(i\\)\\1@y\\.org",
+                "j\\.$@z",
+                "k^l@z",           // anchors, or literals?
+                "\\(^m\\)n$@z",
+                "*o@z",            // a literal '*' (or an error)
+                "\\(*p\\)@z",
+                "^*q@z",
+                "r\\{1,2\\}s@z",
+                "t\\{2,\\}u*@z",
+        };
+        const Mu::StringVec addrs = {
+                "bar-1@fnorb.fi", "bar@fnorb.fi", "abbc@x.org", "ac@x.org", "abc@xxorg",
+                "ddd@foo.com", "dddd@foo.com", "d@foo.com", "dd@f0o.com",
+                "(e+f?)|g@].net", "(ee+f?)|g@].net", "eef@x.net", "g@y.net", "(e+f?)|g@a.net",
+                "xhh@a", "x@^", "h@a", "ii@y.org", "i@y.org", "j.$@z", "j.@z",
+                "k^l@z", "kl@z", "mn@z", "^mn@z", "mn$@z", "*o@z", "o@z", "*p@z", "p@z",
+                "*q@z", "q@z", "rs@z", "rrs@z", "rrrs@z", "s@z", "tu@z", "ttuu@z",
+                "tttu@z", "tt@z",
+        };
 
+        Mu::StringVec personal;
+        std::vector<std::regex> expected;
+        for (auto&& rx: rxs) {
+                personal.emplace_back("/" + rx + "/");
+                try { // some are invalid for some implementations.
+                        expected.emplace_back(rx, std::regex::basic | std::regex::icase);
+                } catch (const std::regex_error&) {}
+        }
+
+        Mu::Contacts contacts{"", personal};
+        for (auto&& addr: addrs) {
+                bool verdict{};
+                for (auto&& rx: expected)
+                        verdict = verdict || std::regex_match(addr, rx);
+                if (verdict != contacts.is_personal(addr))
+                        g_error ("unexpected verdict for '%s'", addr.c_str());
+        }
+}
+
+
+static void
+test_mu_contacts_changes()
+{
+        Mu::Contacts contacts{""};
+
+        contacts.add(Mu::ContactInfo ("a@example.com", "a@example.com", "", false, 1000));
+        contacts.add(Mu::ContactInfo ("b@example.com", "b@example.com", "", false, 2000));
+        contacts.add(Mu::ContactInfo ("c@example.com", "c@example.com", "", false, 3000));
+        contacts.add(Mu::ContactInfo ("d@example.com", "d@example.com", "", false, 4000));
+        g_assert_cmpuint (contacts.seq(), ==, 4);
+
+        // from the start, we get all of them, in order of rank.
+        std::vector<std::string> emails;
+        auto seq = contacts.for_each_since(0, [&](auto&& ci, auto rank) {
+                emails.emplace_back(ci.email);
+                g_assert_cmpuint (rank, ==, emails.size());
+        });
+        g_assert_cmpuint (seq, ==, 4);
+        g_assert_cmpuint (emails.size(), ==, 4);
+
+        // nothing changed.
+        emails.clear();
+        contacts.for_each_since(seq, [&](auto&& ci, auto) { emails.emplace_back(ci.email); });
+        g_assert_true (emails.empty());
+
+        // seeing an old message for 'a' is not a change; a new one for 'b' is.
+        contacts.add(Mu::ContactInfo ("a@example.com", "a@example.com", "", false, 500));
+        contacts.add(Mu::ContactInfo ("Bee <b@example.com>", "b@example.com", "Bee", false, 5000));
+        contacts.add(Mu::ContactInfo ("e@example.com", "e@example.com", "", false, 6000));
+
+        // the ranks must be the same as those for all contacts.
+        std::unordered_map<std::string, size_t> ranks;
+        contacts.for_each([&](auto&& ci) { ranks.emplace(ci.email, ranks.size() + 1); });
+
+        emails.clear();
+        seq = contacts.for_each_since(seq, [&](auto&& ci, auto rank) {
+                emails.emplace_back(ci.email);
+                g_assert_cmpuint (rank, ==, ranks.at(ci.email));
+        });
+        g_assert_cmpuint (seq, ==, 6);
+        g_assert_cmpuint (emails.size(), ==, 2);
+
+        // the sequence numbers survive (de)serialization.
+        Mu::Contacts contacts2{contacts.serialize()};
+        g_assert_cmpuint (contacts2.seq(), ==, 6);
+        g_assert_cmpuint (contacts2._find("b@example.com")->seq, ==, 5);
+
+        emails.clear();
+        contacts2.for_each_since(5, [&](auto&& ci, auto) { emails.emplace_back(ci.email); });
+        g_assert_cmpuint (emails.size(), ==, 1);
+        g_assert_cmpstr (emails.at(0).c_str(), ==, "e@example.com");
+
+        // a sequence number beyond ours (e.g., from before the store was
+        // re-created) gives us everything.
+        emails.clear();
+        seq = contacts2.for_each_since(100, [&](auto&& ci, auto rank) {
+                emails.emplace_back(ci.email);
+                g_assert_cmpuint (rank, ==, emails.size());
+        });
+        g_assert_cmpuint (seq, ==, 6);
+        g_assert_cmpuint (emails.size(), ==, 5);
+
+        // contacts without sequence numbers (from older versions) get one.
+        const std::string sepa{Separator};
+        Mu::Contacts contacts3{"a@example.com" + sepa + "a@example.com" + sepa + sepa +
+                               "0" + sepa + "1000" + sepa + "1\n"};
+        g_assert_cmpuint (contacts3.seq(), ==, 1);
+}
+
+static void
+test_mu_contacts_save_load()
+{
+        std::map<std::string, std::string> stored; // email -> serialized
+
+        Mu::Contacts contacts{""};
+        contacts.add(Mu::ContactInfo ("a@example.com", "a@example.com", "", false, 1000));
+        contacts.add(Mu::ContactInfo ("b@example.com", "b@example.com", "", false, 2000));
+
+        const auto save_func = [&](auto&& email, auto&& serialized) {
+                if (serialized.empty())
+                        stored.erase(email);
+                else
+                        stored[email] = serialized;
+        };
+        g_assert_cmpuint (contacts.save(save_func), ==, 2);
+        g_assert_cmpuint (stored.size(), ==, 2);
+
+        // only the dirty ones get saved.
+        g_assert_cmpuint (contacts.save(save_func), ==, 0);
+        contacts.add(Mu::ContactInfo ("b@example.com", "b@example.com", "", false, 3000));
+        contacts.add(Mu::ContactInfo ("c@example.com", "c@example.com", "", false, 4000));
+        g_assert_cmpuint (contacts.save(save_func), ==, 2);
+        g_assert_cmpuint (stored.size(), ==, 3);
+
+        // load them into a new contacts object
+        Mu::Contacts contacts2{""};
+        contacts2.load([&](auto&& each_serialized) {
+                for (auto&& item: stored)
+                        each_serialized(item.second);
+        });
+        g_assert_cmpuint (contacts2.size(), ==, 3);
+        g_assert_cmpuint (contacts2.seq(), ==, contacts.seq());
+        g_assert_cmpuint (contacts2._find("b@example.com")->freq, ==, 2);
+        g_assert_cmpuint (contacts2.save(save_func), ==, 0);
+
+        // removed contacts get removed from storage as well.
+        contacts2.clear();
+        contacts2.add(Mu::ContactInfo ("a@example.com", "a@example.com", "", false, 1000));
+        g_assert_cmpuint (contacts2.save(save_func), ==, 1);
+        g_assert_cmpuint (stored.size(), ==, 1);
+        g_assert_true (stored.find("a@example.com") != stored.end());
+}
+
+static std::vector<std::string>
+complete (const Mu::Contacts& contacts, const std::string& prefix, size_t maxnum = 0,
+          const Mu::Contacts::ContactPredicate& pred = {})
+{
+        std::vector<std::string> emails;
+        const auto n = contacts.complete(prefix, maxnum, [&](auto&& ci) {
+                emails.emplace_back(ci.email);
+        }, pred);
+        g_assert_cmpuint (n, ==, emails.size());
+
+        return emails;
+}
+
+static void
+test_mu_contacts_complete()
+{
+        Mu::Contacts contacts{""};
+
+        contacts.add(Mu::ContactInfo ("John Doe <john.doe@example.com>",
+                                      "john.doe@example.com", "John Doe", false, 1000));
+        contacts.add(Mu::ContactInfo ("Jane Roe <jane@roe.org>",
+                                      "jane@roe.org", "Jane Roe", true, 2000));
+        contacts.add(Mu::ContactInfo ("Moe <moe@example.com>",
+                                      "moe@example.com", "Moe", false, 3000));
+
+        g_assert_cmpuint (complete(contacts, "jo").size(), ==, 1);
+        g_assert_cmpuint (complete(contacts, "DOE").size(), ==, 1);
+        g_assert_cmpuint (complete(contacts, "john d").size(), ==, 1);
+        g_assert_cmpuint (complete(contacts, "example.c").size(), ==, 2);
+        g_assert_cmpuint (complete(contacts, "oe").size(), ==, 0); // not a word start
+        g_assert_cmpuint (complete(contacts, "").size(), ==, 3);
+
+        // in order of rank; personal contacts come first.
+        auto emails{complete(contacts, "j")};
+        g_assert_cmpuint (emails.size(), ==, 2);
+        g_assert_cmpstr (emails.at(0).c_str(), ==, "jane@roe.org");
+        emails = complete(contacts, "", 2);
+        g_assert_cmpuint (emails.size(), ==, 2);
+        g_assert_cmpstr (emails.at(0).c_str(), ==, "jane@roe.org");
+
+        emails = complete(contacts, "j", 0, [](auto&& ci) { return !ci.personal; });
+        g_assert_cmpuint (emails.size(), ==, 1);
+        g_assert_cmpstr (emails.at(0).c_str(), ==, "john.doe@example.com");
+
+        // new contacts and changed names are picked up.
+        contacts.add(Mu::ContactInfo ("Jim <jim@example.com>",
+                                      "jim@example.com", "Jim", false, 4000));
+        g_assert_cmpuint (complete(contacts, "ji").size(), ==, 1);
+        contacts.add(Mu::ContactInfo ("Joanna Doe <jane@roe.org>",
+                                      "jane@roe.org", "Joanna Doe", true, 5000));
+        g_assert_cmpuint (complete(contacts, "jane").size(), ==, 1); // address
+        g_assert_cmpuint (complete(contacts, "jane r").size(), ==, 0);
+        g_assert_cmpuint (complete(contacts, "joanna").size(), ==, 1);
+}
+
+static void
+test_mu_contacts_rank()
+{
+        constexpr time_t Day{24 * 3600};
+        const time_t now{::time({})};
+
+        Mu::Contacts contacts{""};
+        const auto add = [&](const std::string& email, time_t t, size_t n = 1) {
+                for (size_t i = 0; i != n; ++i)
+                        contacts.add(Mu::ContactInfo(email, email, "", false, t));
+        };
+        const auto top = [&](size_t maxnum) {
+                std::vector<std::string> emails;
+                contacts.for_each([&](auto&& ci) { emails.emplace_back(ci.email); },
+                                  maxnum);
+                return emails;
+        };
+
+        // 60 days is four half-lives, so 10 sightings back then count for
+        // less than one today, and 20 for more.
+        add("a@example.com", now - 60 * Day, 10);
+        add("b@example.com", now);
+        add("c@example.com", now - 60 * Day, 20);
+        g_assert_true (top(0) == Mu::StringVec({"c@example.com", "b@example.com",
+                                                "a@example.com"}));
+        g_assert_true (top(2) == Mu::StringVec({"c@example.com", "b@example.com"}));
+
+        // the order of the sightings does not matter.
+        add("d@example.com", now - 30 * Day);
+        add("d@example.com", now);
+        add("e@example.com", now);
+        add("e@example.com", now - 30 * Day);
+        g_assert_cmpfloat (contacts._find("d@example.com")->score, ==,
+                           contacts._find("e@example.com")->score);
+
+        // personal contacts come first
+        contacts.add(Mu::ContactInfo("f@example.com", "f@example.com", "", true,
+                                     now - 1000 * Day));
+        g_assert_true (top(1) == Mu::StringVec({"f@example.com"}));
+
+        // and the scores survive saving / loading.
+        std::vector<std::string> saved;
+        contacts.save([&](auto&&, auto&& serialized) { saved.emplace_back(serialized); },
+                      true/*all*/);
+        Mu::Contacts contacts2{""};
+        contacts2.load([&](auto&& each_serialized) {
+                for (auto&& ser: saved)
+                        each_serialized(ser);
+        });
+        std::vector<std::string> emails2;
+        contacts2.for_each([&](auto&& ci) { emails2.emplace_back(ci.email); });
+        g_assert_true (emails2 == top(0));
+}
+
+static void
+test_mu_contacts_add_pending()
+{
+        Mu::Contacts contacts{""};
+
+        contacts.add(Mu::ContactInfo ("a@example.com", "a@example.com", "", false, 1000));
+
+        contacts.add_pending(Mu::ContactInfo ("Aa <a@example.com>", "a@example.com",
+                                              "Aa", false, 3000));
+        contacts.add_pending(Mu::ContactInfo ("A <A@example.com>", "A@example.com",
+                                              "A", false, 2000));
+        contacts.add_pending(Mu::ContactInfo ("b@example.com", "b@example.com",
+                                              "", false, 500));
+        contacts.add_pending(Mu::ContactInfo ("Bee <b@example.com>", "b@example.com",
+                                              "Bee", true, 700));
+        contacts.add_pending(Mu::ContactInfo ("b@example.com", "b@example.com",
+                                              "", false, 600));
+
+        g_assert_cmpuint (contacts.size(), ==, 2);
+
+        const auto a{contacts._find("a@example.com")};
+        g_assert_true (a);
+        g_assert_cmpuint (a->freq, ==, 3);
+        g_assert_cmpuint (a->last_seen, ==, 3000);
+        g_assert_cmpstr (a->name.c_str(), ==, "Aa");
+        g_assert_false (a->personal);
+
+        const auto b{contacts._find("b@example.com")};
+        g_assert_true (b);
+        g_assert_cmpuint (b->freq, ==, 3);
+        g_assert_cmpuint (b->last_seen, ==, 700);
+        g_assert_cmpstr (b->full_address.c_str(), ==, "Bee <b@example.com>");
+        g_assert_true (b->personal);
+
+        g_assert_cmpuint (contacts.seq(), ==, 3);
+
+        // cleared contacts stay cleared.
+        contacts.add_pending(Mu::ContactInfo ("c@example.com", "c@example.com",
+                                              "", false, 500));
+        contacts.clear();
+        g_assert_true (contacts.empty());
+}
+
+static void
+test_mu_contacts_add_pending_stress()
+{
+        constexpr size_t ThreadNum = 16;
+        constexpr size_t AddNum    = 20000; // per thread
+        constexpr size_t EmailNum  = 1000;
+
+        const auto email = [](size_t i) {
+                return Mu::format(i % 2 ? "user%zu@example.com" : "User%zu@Example.Com",
+                                  i % EmailNum);
+        };
+        const auto contact = [&](size_t thread, size_t i) {
+                // each (thread, i) has its own last_seen, so the most recent
+                // one is well-defined.
+                const auto last_seen{static_cast<time_t>(1 + (i * ThreadNum + thread) % 99991)};
+                const auto name{Mu::format("User %zu", static_cast<size_t>(last_seen))};
+                return Mu::ContactInfo(name + " <" + email(i) + ">", email(i), name,
+                                       (i % EmailNum) % 7 == 0, last_seen);
+        };
+
+        // the same contacts, added one after the other.
+        Mu::Contacts expected{""};
+        for (size_t thread = 0; thread != ThreadNum; ++thread)
+                for (size_t i = 0; i != AddNum; ++i)
+                        expected.add(contact(thread, i));
+
+        // and from many threads, while others read them.
+        Mu::Contacts contacts{""};
+        std::atomic<bool> done{};
+        std::vector<std::thread> threads;
+        for (size_t thread = 0; thread != ThreadNum; ++thread)
+                threads.emplace_back([&, thread] {
+                        for (size_t i = 0; i != AddNum; ++i)
+                                contacts.add_pending(contact(thread, i));
+                });
+        std::thread reader([&] {
+                size_t seen{};
+                while (!done) {
+                        const auto n{contacts.size()};
+                        g_assert_cmpuint (n, >=, seen);
+                        g_assert_cmpuint (n, <=, EmailNum);
+                        seen = n;
+                        contacts.for_each_since(contacts.seq(), [](auto&&, auto) {});
+                }
+        });
+        for (auto&& t: threads)
+                t.join();
+        done = true;
+        reader.join();
+
+        g_assert_cmpuint (contacts.size(), ==, expected.size());
+        size_t freq{};
+        expected.for_each([&](const Mu::ContactInfo& ci) {
+                const auto other{contacts._find(ci.email)};
+                g_assert_true (other);
+                g_assert_cmpuint (other->freq, ==, ci.freq);
+                g_assert_cmpuint (other->last_seen, ==, ci.last_seen);
+                g_assert_cmpstr (other->name.c_str(), ==, ci.name.c_str());
+                g_assert_cmpstr (other->email.c_str(), ==, ci.email.c_str());
+                g_assert_true (other->personal == ci.personal);
+                freq += other->freq;
+        });
+        g_assert_cmpuint (freq, ==, ThreadNum * AddNum);
+}
+
+// some random contacts
+struct RandomContacts {
+        RandomContacts(size_t num) {
+                for (size_t i = 0; i != num; ++i)
+                        add(i);
+        }
+        std::string word() {
+                static const char* syllables[] = {
+                        "an", "ber", "cho", "da", "el", "fi", "go", "ha", "is", "jo",
+                        "ka", "li", "mo", "ne", "or", "pa", "qui", "ro", "sa", "tu" };
+                std::string w;
+                for (auto n = 2 + rng() % 3; n != 0; --n)
+                        w += syllables[rng() % G_N_ELEMENTS(syllables)];
+                return w;
+        }
+        void add(size_t i) {
+                const auto first{word()}, last{word()};
+                const auto email{Mu::format("%s.%s%zu@%s.com", first.c_str(), last.c_str(),
+                                            i, word().c_str())};
+                const auto name{first + " " + last};
+                contacts.add(Mu::ContactInfo(name + " <" + email + ">", email, name,
+                                             rng() % 16 == 0, rng() % 1000000, 1));
+        }
+
+        std::mt19937 rng{42};
+        Mu::Contacts contacts{""};
+};
+
+static void
+test_mu_contacts_complete_top()
+{
+        RandomContacts rc{5000};
+
+        const auto check = [&] {
+                for (size_t i = 0; i != 200; ++i) {
+                        const auto prefix{rc.word().substr(0, 1 + rc.rng() % 4)};
+                        auto all{complete(rc.contacts, prefix)};
+                        const auto top{complete(rc.contacts, prefix, 5)};
+                        all.resize(std::min<size_t>(all.size(), 5));
+                        g_assert_true (all == top);
+                }
+        };
+
+        check();
+
+        // new and changed contacts; first a few, and then so many that we
+        // need to re-rank.
+        const auto emails{complete(rc.contacts, "")};
+        for (auto num: {100, 2000}) {
+                for (auto i = 0; i != num; ++i) {
+                        rc.add(10000 + i);
+                        const auto& email{emails.at(rc.rng() % emails.size())};
+                        const std::string name{rc.contacts._find(email)->name};
+                        rc.contacts.add(Mu::ContactInfo(email, email, name, false,
+                                                        1000000 + rc.rng() % 1000));
+                }
+                check();
+        }
+}
+
+static void
+test_mu_contacts_perf_complete()
+{
+        constexpr size_t ContactNum = 300 * 1000;
+        constexpr size_t Lookups    = 10 * 1000;
+
+        RandomContacts rc{ContactNum};
+        auto& contacts{rc.contacts};
+        const auto word = [&] { return rc.word(); };
+        auto& rng{rc.rng};
+
+        g_test_timer_start();
+        complete(contacts, "x"); // build the index
+        const auto build_elapsed{g_test_timer_elapsed()};
+
+        std::vector<std::string> prefixes;
+        for (size_t i = 0; i != Lookups; ++i)
+                prefixes.emplace_back(word().substr(0, 2 + rng() % 3));
+
+        size_t found{};
+        g_test_timer_start();
+        for (auto&& prefix: prefixes)
+                found += complete(contacts, prefix, 10).size();
+        const auto elapsed{g_test_timer_elapsed()};
+
+        g_assert_cmpuint (found, >, 0);
+        g_test_minimized_result(elapsed / Lookups,
+                                "completing among %zu contacts: index: %.3fs; "
+                                "%.1fus per lookup", ContactNum, build_elapsed,
+                                1000 * 1000 * elapsed / Lookups);
+}
+
+static void
+test_mu_contacts_perf_add()
+{
+        constexpr size_t ContactNum = 100 * 1000;
+        constexpr size_t AddNum     = 2 * 1000 * 1000;
+
+        std::mt19937 rng{42};
+        std::vector<Mu::ContactInfo> cis;
+        for (size_t i = 0; i != ContactNum; ++i) {
+                const auto email{Mu::format("Some.User%zu@Example%zu.Com", i, i % 97)};
+                cis.emplace_back("Some User <" + email + ">", email, "Some User",
+                                 false, 1000);
+        }
+        std::vector<size_t> order;
+        for (size_t i = 0; i != AddNum; ++i)
+                order.emplace_back(rng() % ContactNum);
+
+        Mu::Contacts contacts{""};
+        g_test_timer_start();
+        for (auto&& i: order) {
+                auto ci{cis[i]};
+                contacts.add(std::move(ci));
+        }
+        const auto elapsed{g_test_timer_elapsed()};
+
+        g_assert_cmpuint (contacts.size(), <=, ContactNum);
+        g_test_minimized_result(elapsed, "adding %zu contacts (%zu different): %.3fs",
+                                AddNum, contacts.size(), elapsed);
+
+        // the top-10, after each of a few more changes.
+        constexpr size_t TopNum = 1000;
+        size_t n{};
+        g_test_timer_start();
+        for (size_t i = 0; i != TopNum; ++i) {
+                auto ci{cis[order[i]]};
+                contacts.add(std::move(ci));
+                contacts.for_each([&](auto&&) { ++n; }, 10);
+        }
+        const auto top_elapsed{g_test_timer_elapsed()};
+
+        g_assert_cmpuint (n, ==, 10 * TopNum);
+        g_test_minimized_result(top_elapsed / TopNum, "top-10 after a change: %.1fus",
+                                1000 * 1000 * top_elapsed / TopNum);
+}
 
 int
 main (int argc, char *argv[])
@@ -393,6 +1656,21 @@ main (int argc, char *argv[])
 
         g_test_add_func ("/mu-contacts/01", test_mu_contacts_01);
         g_test_add_func ("/mu-contacts/02", test_mu_contacts_02);
+        g_test_add_func ("/mu-contacts/personal-rx", test_mu_contacts_personal_rx);
+        g_test_add_func ("/mu-contacts/changes", test_mu_contacts_changes);
+        g_test_add_func ("/mu-contacts/save-load", test_mu_contacts_save_load);
+        g_test_add_func ("/mu-contacts/rank", test_mu_contacts_rank);
+        g_test_add_func ("/mu-contacts/add-pending", test_mu_contacts_add_pending);
+        g_test_add_func ("/mu-contacts/add-pending-stress",
+                         test_mu_contacts_add_pending_stress);
+        g_test_add_func ("/mu-contacts/complete", test_mu_contacts_complete);
+        g_test_add_func ("/mu-contacts/complete-top", test_mu_contacts_complete_top);
+
+        if (g_test_perf()) {
+                g_test_add_func ("/mu-contacts/perf/complete",
+                                 test_mu_contacts_perf_complete);
+                g_test_add_func ("/mu-contacts/perf/add", test_mu_contacts_perf_add);
+        }
 
         g_log_set_handler (NULL,
                            (GLogLevelFlags)
@@ -59,7 +59,8 @@ struct ContactInfo {
         time_t      last_seen{};  /**< when was this contact last seen? */
         std::size_t freq{};       /**< how often was this contact seen? */
 
-        int64_t     tstamp{};     /**< Time-stamp, as per g_get_monotonic_time */
+        uint64_t    seq{};        /**< Sequence number of the latest change */
+        double      score{};      /**< Decayed frequency, for ranking contacts */
 };
 
 /// All contacts
@@ -90,6 +91,22 @@ public:
          */
         const ContactInfo add(ContactInfo&& ci);
 
+        /**
+         * Add a contact, like add(), but only collect it (in one of a number
+         * of lock-striped shards), so many threads can add contacts
+         * concurrently without contending for a single lock. The collected
+         * contacts are merged with the others before anything else accesses
+         * them.
+         *
+         * When a contact is collected more than once before it is merged, the
+         * frequencies are added up, the name and address are those of the
+         * most recently seen one, and the contact is personal if any of them
+         * is.
+         *
+         * @param ci A contact-info object
+         */
+        void add_pending(ContactInfo&& ci);
+
         /**
          * Clear all contacts
          *
@@ -118,6 +135,47 @@ public:
          */
         std::string serialize() const;
 
+        /**
+         * Prototype for a callable that receives a serialized contact
+         *
+         * @param serialized a single contact, serialized
+         */
+        using EachSerializedFunc = std::function<void (const std::string& serialized)>;
+
+        /**
+         * Prototype for a callable that loads contacts, by calling its argument
+         * for each serialized contact.
+         */
+        using LoadFunc = std::function<void (const EachSerializedFunc& each_serialized)>;
+
+        /**
+         * Load (more) contacts; these replace the existing contacts with the
+         * same e-mail address. Loading does not make the contacts dirty.
+         *
+         * @param load_func a load function
+         */
+        void load (const LoadFunc& load_func);
+
+        /**
+         * Prototype for a callable that saves a contact
+         *
+         * @param email the contact's e-mail address
+         * @param serialized the serialized contact, or empty if the contact
+         * should be removed.
+         */
+        using SaveFunc = std::function<void (const std::string& email,
+                                             const std::string& serialized)>;
+        /**
+         * Save the contacts that changed (i.e., are 'dirty') since they were
+         * last saved or loaded, and mark them as clean.
+         *
+         * @param save_func a save function
+         * @param all if true, save all contacts rather than only the dirty ones
+         *
+         * @return the number of contacts saved
+         */
+        std::size_t save (const SaveFunc& save_func, bool all=false);
+
 
         /**
          * Does this look like a 'personal' address?
@@ -146,11 +204,79 @@ public:
         using EachContactFunc = std::function<void (const ContactInfo& contact_info)>;
 
         /**
-         * Invoke some callable for each contact, in order of rank.
+         * Invoke some callable for each contact, in order of rank. Personal
+         * contacts come first; then the contacts that were seen more often,
+         * where a sighting counts for less the longer ago it was. The contacts
+         * are kept in this order, so there is no need to sort them.
+         *
+         * @param each_contact
+         * @param maxnum maximum number of contacts, or 0 for no limit
+         */
+        void for_each (const EachContactFunc& each_contact, std::size_t maxnum=0) const;
+
+        /**
+         * Prototype for a callable that receives a contact and its rank
          *
+         * @param contact some contact
+         * @param rank the rank (1-based) of the contact among _all_ contacts
+         */
+        using EachRankedContactFunc = std::function<void (const ContactInfo& contact_info,
+                                                          std::size_t rank)>;
+        /**
+         * Invoke some callable for each contact that was added or changed
+         * after the given sequence number, in order of rank. This uses the
+         * change log, so we do not need to sort all contacts for a few
+         * changes.
+         *
+         * @param seq a sequence number, as returned by an earlier call, or 0
+         * for all contacts. A number greater than the current one (e.g., from
+         * an earlier incarnation of the store) is treated as 0.
          * @param each_contact
+         *
+         * @return the current sequence number
+         */
+        uint64_t for_each_since (uint64_t seq,
+                                 const EachRankedContactFunc& each_contact) const;
+
+        /**
+         * Prototype for a callable that decides whether a contact is
+         * acceptable.
+         *
+         * @param contact some contact
+         *
+         * @return true or false
+         */
+        using ContactPredicate = std::function<bool (const ContactInfo& contact_info)>;
+
+        /**
+         * Invoke some callable for the best-ranked contacts that match some
+         * prefix, in order of rank. The prefix matches (case- and
+         * accent-insensitively) the start of any word in the name or e-mail
+         * address of a contact, e.g. "jo", "doe", "john d", "example.c" all
+         * match "John Doe <john.doe@example.com>".
+         *
+         * The contacts are found through a (sorted) index of such words,
+         * which is built when first needed, and then kept up-to-date.
+         *
+         * @param prefix a prefix
+         * @param maxnum maximum number of contacts, or 0 for no limit
+         * @param each_contact the callable
+         * @param pred if set, only consider contacts for which this is true
+         *
+         * @return the number of contacts passed to each_contact
+         */
+        std::size_t complete (const std::string& prefix, std::size_t maxnum,
+                              const EachContactFunc& each_contact,
+                              const ContactPredicate& pred = {}) const;
+
+        /**
+         * Get the sequence number of the latest change. Sequence numbers are
+         * stored with the contacts, so they keep on increasing when the store
+         * is re-opened.
+         *
+         * @return the sequence number
          */
-        void for_each (const EachContactFunc& each_contact) const;
+        uint64_t seq() const;
 
 private:
         struct                   Private;
@@ -0,0 +1,517 @@
+/*
+** Copyright (C) 2021 Dirk-Jan C. Binnema <djcb@djcbsoftware.nl>
+**
+** This program is free software; you can redistribute it and/or modify it
+** under the terms of the GNU General Public License as published by the
+** Free Software Foundation; either version 3, or (at your option) any
+** later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software Foundation,
+** Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+**
+*/
+
+#include "mu-header-sexp.hh"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <glib.h>
+#include <gmime/gmime.h>
+
+#include "mu-flags.hh"
+#include "mu-msg-fields.h"
+#include "mu-msg-prio.h"
+#include "mu-query-results.hh"
+#include "utils/mu-sexp.hh"
+
+using namespace Mu;
+
+// Everything here writes the s-expression in the same way as msg_to_sexp()
+// does for a database-backed MuMsg (see mu-msg-sexp.cc)
+
+/// A contact; we re-use these (and their strings' buffers) between messages.
+struct Contact {
+        bool        has_name{};
+        std::string name;
+        std::string email;
+};
+using Contacts = std::vector<Contact>;
+
+// assign [b, e) to str, with control characters (and spaces) collapsed like
+// remove_ctrl() does, and optionally unescaping backslash-escaped characters.
+static void
+assign_noctrl (std::string& str, const char* b, const char* e, bool unescape = false)
+{
+        str.clear();
+
+        char prev{'\0'};
+        for (; b != e; ++b) {
+                auto c{*b};
+                if (unescape && c == '\\' && b + 1 != e)
+                        c = *++b;
+                if (::iscntrl(static_cast<unsigned char>(c)) || c == ' ') {
+                        if (prev == ' ')
+                                continue;
+                        c = ' ';
+                }
+                str += prev = c;
+        }
+}
+
+static Contact&
+next_contact (Contacts& contacts, size_t& n)
+{
+        if (n == contacts.size())
+                contacts.emplace_back();
+
+        return contacts[n++];
+}
+
+static bool
+is_blank (char c)
+{
+        return c == ' ' || c == '\t';
+}
+
+// Parse the address-list, as written to the store by
+// internet_address_list_to_string(), i.e. items like
+//      foo@example.com
+//      Some Name <foo@example.com>
+//      "Name, Some" <foo@example.com>
+// separated by commas. Return false for anything else (such as groups), so the
+// caller can fall back to GMime.
+static bool
+parse_contacts_fast (const std::string& addrs, Contacts& contacts, size_t& n)
+{
+        const char *cur{addrs.data()}, *end{addrs.data() + addrs.size()};
+
+        while (true) {
+                while (cur != end && is_blank(*cur))
+                        ++cur;
+                if (cur == end)
+                        return true;
+
+                const char *nb{}, *ne{}, *eb{}, *ee{};
+                bool quoted{};
+
+                if (*cur == '"') { // quoted name
+                        nb = ++cur;
+                        while (cur != end && *cur != '"')
+                                cur += (*cur == '\\' && cur + 1 != end) ? 2 : 1;
+                        if (cur == end)
+                                return false;
+                        ne     = cur++;
+                        quoted = true;
+                        while (cur != end && is_blank(*cur))
+                                ++cur;
+                        if (cur == end || *cur != '<')
+                                return false;
+                } else {
+                        auto tb{cur};
+                        while (cur != end && *cur != ',' && *cur != '<') {
+                                if (::strchr("\"\\():;[]", *cur))
+                                        return false;
+                                ++cur;
+                        }
+                        auto te{cur};
+                        while (te != tb && is_blank(*(te - 1)))
+                                --te;
+                        if (cur != end && *cur == '<') {
+                                nb = tb;
+                                ne = te;
+                        } else { // just an address.
+                                if (tb == te ||
+                                    std::find_if(tb, te, is_blank) != te)
+                                        return false;
+                                eb = tb;
+                                ee = te;
+                        }
+                }
+
+                if (!eb) { // <address>
+                        eb = ++cur;
+                        while (cur != end && *cur != '>')
+                                ++cur;
+                        if (cur == end || cur == eb)
+                                return false;
+                        ee = cur++;
+                }
+
+                auto& contact{next_contact(contacts, n)};
+                contact.has_name = nb != ne;
+                assign_noctrl(contact.name, nb, ne, quoted);
+                assign_noctrl(contact.email, eb, ee);
+
+                while (cur != end && is_blank(*cur))
+                        ++cur;
+                if (cur != end && *cur++ != ',')
+                        return false;
+        }
+}
+
+// the slow path, equivalent to what MuMsg does for database-backed messages.
+static void
+parse_contacts_gmime (const std::string& addrs, Contacts& contacts, size_t& n)
+{
+        auto addrlist{internet_address_list_parse(NULL, addrs.c_str())};
+        if (!addrlist)
+                return;
+
+        for (auto i = 0; i != internet_address_list_length(addrlist); ++i) {
+                auto addr{internet_address_list_get_address(addrlist, i)};
+                if (!addr)
+                        continue;
+
+                const char *name{internet_address_get_name(addr)};
+                if (name && !name[0])
+                        name = NULL;
+
+                const char *email{INTERNET_ADDRESS_IS_MAILBOX(addr) ?
+                                internet_address_mailbox_get_addr(
+                                        INTERNET_ADDRESS_MAILBOX(addr)) : NULL};
+                if (name && !email)
+                        email = name;
+                if (!email)
+                        continue;
+
+                auto& contact{next_contact(contacts, n)};
+                contact.has_name = name != NULL;
+                assign_noctrl(contact.name, name, name ? name + ::strlen(name) : name);
+                assign_noctrl(contact.email, email, email + ::strlen(email));
+        }
+
+        g_object_unref(addrlist);
+}
+
+static void
+write_contacts (SexpWriter& writer, const Xapian::Document& doc)
+{
+        static thread_local Contacts contacts;
+
+        const struct {
+                MuMsgFieldId field;
+                const char*  name;
+        } contact_fields[] = {
+                { MU_MSG_FIELD_ID_FROM, ":from" },
+                { MU_MSG_FIELD_ID_TO,   ":to"   },
+                { MU_MSG_FIELD_ID_CC,   ":cc"   },
+                { MU_MSG_FIELD_ID_BCC,  ":bcc"  },
+        };
+
+        for (auto&& cfield: contact_fields) {
+                const auto addrs{doc.get_value(cfield.field)};
+                if (addrs.empty())
+                        continue;
+
+                size_t n{};
+                if (!parse_contacts_fast(addrs, contacts, n)) {
+                        n = 0;
+                        parse_contacts_gmime(addrs, contacts, n);
+                }
+                if (n == 0)
+                        continue;
+
+                writer.prop(cfield.name).begin_list();
+                for (size_t i = 0; i != n; ++i) {
+                        const auto& contact{contacts[i]};
+                        writer.begin_list();
+                        if (contact.has_name)
+                                writer.string(contact.name);
+                        else
+                                writer.symbol("nil");
+                        writer.symbol(".").string(contact.email).end_list();
+                }
+                writer.end_list();
+        }
+}
+
+// a list of strings, separated by ',' in val, like mu_str_to_list()
+static void
+write_prop_nonempty_list (SexpWriter& writer, const char* name, const std::string& val)
+{
+        if (val.empty())
+                return;
+
+        writer.prop(name).begin_list();
+
+        const char *b{val.data()}, *end{val.data() + val.size()};
+        while (true) {
+                auto e{static_cast<const char*>(::memchr(b, ',', end - b))};
+                if (!e)
+                        e = end;
+
+                auto sb{b}, se{e}; // like g_strstrip
+                while (sb != se && g_ascii_isspace(*sb))
+                        ++sb;
+                while (se != sb && g_ascii_isspace(*(se - 1)))
+                        --se;
+
+                writer.string(sb, se - sb);
+
+                if (e == end)
+                        break;
+                b = e + 1;
+        }
+
+        writer.end_list();
+}
+
+static void
+write_prop_nonempty (SexpWriter& writer, const char* name, const std::string& val)
+{
+        if (!val.empty())
+                writer.prop(name).string(val);
+}
+
+static int64_t
+num_value (const Xapian::Document& doc, MuMsgFieldId field)
+{
+        const auto val{doc.get_value(field)};
+        if (val.empty())
+                return 0;
+        else if (field == MU_MSG_FIELD_ID_DATE || field == MU_MSG_FIELD_ID_SIZE)
+                return ::strtol(val.c_str(), NULL, 10);
+        else
+                return static_cast<int64_t>(Xapian::sortable_unserialise(val));
+}
+
+static void
+write_date_tstamp (SexpWriter& writer, int64_t t)
+{
+        writer.begin_list()
+                .number(static_cast<int>(static_cast<unsigned>(t >> 16)))
+                .number(static_cast<int>(static_cast<unsigned>(t & 0xffff)))
+                .number(0)
+                .end_list();
+}
+
+static void
+write_flags (SexpWriter& writer, MuFlags flags)
+{
+        struct FlagData {
+                MuFlags     flags;
+                const char* names[32];
+                size_t      n;
+        } fdata{flags, {}, 0};
+
+        mu_flags_foreach([](MuFlags flag, gpointer user_data) {
+                auto fdata{reinterpret_cast<FlagData*>(user_data)};
+                if ((flag & fdata->flags) && fdata->n < G_N_ELEMENTS(fdata->names))
+                        fdata->names[fdata->n++] = mu_flag_name(flag);
+        }, &fdata);
+
+        if (fdata.n == 0)
+                return;
+
+        writer.prop(":flags").begin_list();
+        for (size_t i = 0; i != fdata.n; ++i)
+                writer.symbol(fdata.names[i]);
+        writer.end_list();
+}
+
+static void
+write_thread_info (SexpWriter& writer, const QueryMatch& qmatch)
+{
+        writer.prop(":thread").begin_prop_list()
+                .prop(":path").string(qmatch.thread_path.to_string())
+                .prop(":level").number(static_cast<int>(qmatch.thread_level))
+                .prop(":date").string(qmatch.thread_date)
+                .prop(":date-tstamp");
+        write_date_tstamp(writer, ::atoi(qmatch.thread_date.c_str()));
+
+        const struct {
+                QueryMatch::Flags flag;
+                const char*       name;
+        } thread_flags[] = {
+                { QueryMatch::Flags::Root,          ":root" },
+                { QueryMatch::Flags::Related,       ":related" },
+                { QueryMatch::Flags::First,         ":first-child" },
+                { QueryMatch::Flags::Last,          ":last-child" },
+                { QueryMatch::Flags::Orphan,        ":orphan" },
+                { QueryMatch::Flags::Duplicate,     ":duplicate" },
+                { QueryMatch::Flags::HasChild,      ":has-child" },
+                { QueryMatch::Flags::ThreadSubject, ":thread-subject" },
+        };
+        for (auto&& tflag: thread_flags)
+                if (qmatch.has_flag(tflag.flag))
+                        writer.prop(tflag.name).symbol(Sexp::SymbolT);
+
+        writer.end_prop_list();
+}
+
+void
+Mu::write_header_props (SexpWriter& writer, const Xapian::Document& doc,
+                        unsigned docid, const QueryMatch* qmatch)
+{
+        if (docid != 0)
+                writer.prop(":docid").number(static_cast<int>(docid));
+
+        write_prop_nonempty(writer, ":subject",    doc.get_value(MU_MSG_FIELD_ID_SUBJECT));
+        write_prop_nonempty(writer, ":message-id", doc.get_value(MU_MSG_FIELD_ID_MSGID));
+
+        auto mlist{doc.get_value(MU_MSG_FIELD_ID_MAILING_LIST)};
+        if (mlist.find("=?") != std::string::npos) { // encoded; rare.
+                auto decml{g_mime_utils_header_decode_text(NULL, mlist.c_str())};
+                mlist = decml ? decml : "";
+                g_free(decml);
+        }
+        write_prop_nonempty(writer, ":mailing-list", mlist);
+
+        write_prop_nonempty(writer, ":path",    doc.get_value(MU_MSG_FIELD_ID_PATH));
+        write_prop_nonempty(writer, ":maildir", doc.get_value(MU_MSG_FIELD_ID_MAILDIR));
+
+        // no name for MU_MSG_PRIO_NONE, nor for unknown values.
+        const auto prio{static_cast<MuMsgPrio>(num_value(doc, MU_MSG_FIELD_ID_PRIO))};
+        if (const auto prio_name = mu_msg_prio_name(prio))
+                writer.prop(":priority").symbol(prio_name);
+
+        write_contacts(writer, doc);
+
+        write_prop_nonempty_list(writer, ":references", doc.get_value(MU_MSG_FIELD_ID_REFS));
+
+        auto date{num_value(doc, MU_MSG_FIELD_ID_DATE)};
+        if (date == -1) /* invalid date? */
+                date = 0;
+        writer.prop(":date");
+        write_date_tstamp(writer, date);
+
+        auto size{static_cast<size_t>(num_value(doc, MU_MSG_FIELD_ID_SIZE))};
+        if (size == static_cast<size_t>(-1)) /* invalid size? */
+                size = 0;
+        writer.prop(":size").number(static_cast<int>(size));
+
+        write_flags(writer, static_cast<MuFlags>(num_value(doc, MU_MSG_FIELD_ID_FLAGS)));
+        write_prop_nonempty_list(writer, ":tags", doc.get_value(MU_MSG_FIELD_ID_TAGS));
+
+        if (qmatch)
+                write_thread_info(writer, *qmatch);
+}
+
+void
+Mu::write_header_sexp (SexpWriter& writer, const Xapian::Document& doc,
+                       unsigned docid, const QueryMatch* qmatch)
+{
+        writer.begin_prop_list();
+        write_header_props(writer, doc, docid, qmatch);
+        writer.end_prop_list();
+}
+
+
+#ifdef BUILD_TESTS
+/*
+ * Tests.
+ *
+ */
+
+#include "test-mu-common.hh"
+
+static Xapian::Document
+make_doc ()
+{
+        Xapian::Document doc;
+
+        doc.add_value(MU_MSG_FIELD_ID_SUBJECT, "Hello \"world\"");
+        doc.add_value(MU_MSG_FIELD_ID_MSGID, "abc@example.com");
+        doc.add_value(MU_MSG_FIELD_ID_PATH, "/home/user/Maildir/inbox/cur/msg1:2,S");
+        doc.add_value(MU_MSG_FIELD_ID_MAILDIR, "/inbox");
+        doc.add_value(MU_MSG_FIELD_ID_PRIO,
+                      Xapian::sortable_serialise(MU_MSG_PRIO_NORMAL));
+        doc.add_value(MU_MSG_FIELD_ID_FROM, "Some One <some@example.com>");
+        doc.add_value(MU_MSG_FIELD_ID_TO,
+                      "\"One, Some\" <one@example.com>, other@example.com");
+        doc.add_value(MU_MSG_FIELD_ID_CC, "\"Some \\\"Nick\\\" One\" <nick@example.com>");
+        doc.add_value(MU_MSG_FIELD_ID_REFS, "ref1@example.com,ref2@example.com");
+        doc.add_value(MU_MSG_FIELD_ID_DATE, "0001234567");
+        doc.add_value(MU_MSG_FIELD_ID_SIZE, "0000004321");
+        doc.add_value(MU_MSG_FIELD_ID_FLAGS,
+                      Xapian::sortable_serialise(MU_FLAG_SEEN | MU_FLAG_REPLIED));
+        doc.add_value(MU_MSG_FIELD_ID_TAGS, "foo, bar");
+
+        return doc;
+}
+
+static void
+test_header_sexp()
+{
+        std::string buf;
+        SexpWriter writer{buf};
+        write_header_sexp(writer, make_doc(), 123);
+
+        const auto expected = std::string{
+                "(:docid 123"
+                " :subject \"Hello \\\"world\\\"\""
+                " :message-id \"abc@example.com\""
+                " :path \"/home/user/Maildir/inbox/cur/msg1:2,S\""
+                " :maildir \"/inbox\""
+                " :priority normal"
+                " :from ((\"Some One\" . \"some@example.com\"))"
+                " :to ((\"One, Some\" . \"one@example.com\") (nil . \"other@example.com\"))"
+                " :cc ((\"Some \\\"Nick\\\" One\" . \"nick@example.com\"))"
+                " :references (\"ref1@example.com\" \"ref2@example.com\")"
+                " :date (18 54919 0)"
+                " :size 4321"
+                " :flags (replied seen)"
+                " :tags (\"foo\" \"bar\"))"};
+
+        assert_equal(buf, expected);
+}
+
+static void
+test_header_sexp_thread()
+{
+        QueryMatch qmatch;
+        qmatch.thread_path  = ThreadPath{{}, 1, false};
+        qmatch.thread_level = 1;
+        qmatch.thread_date  = "0001234567";
+        qmatch.flags        = QueryMatch::Flags::Root | QueryMatch::Flags::HasChild;
+
+        std::string buf;
+        SexpWriter writer{buf};
+        write_header_sexp(writer, Xapian::Document{}, 0, &qmatch);
+
+        assert_equal(buf,
+                     "(:date (0 0 0) :size 0"
+                     " :thread (:path \"\" :level 1 :date \"0001234567\""
+                     " :date-tstamp (18 54919 0) :root t :has-child t))");
+}
+
+static void
+test_header_sexp_json()
+{
+        Xapian::Document doc;
+        doc.add_value(MU_MSG_FIELD_ID_SUBJECT, "Tab\there");
+        doc.add_value(MU_MSG_FIELD_ID_FROM, "foo@example.com");
+        doc.add_value(MU_MSG_FIELD_ID_FLAGS, Xapian::sortable_serialise(MU_FLAG_SEEN));
+
+        std::string buf;
+        SexpWriter writer{buf, SexpWriter::Format::Json};
+        write_header_sexp(writer, doc, 7);
+
+        assert_equal(buf,
+                     "{\":docid\":7,\":subject\":\"Tab\\there\","
+                     "\":from\":[[false,\".\",\"foo@example.com\"]],"
+                     "\":date\":[0,0,0],\":size\":0,\":flags\":[\"seen\"]}");
+}
+
+int
+main (int argc, char *argv[])
+{
+        g_test_init (&argc, &argv, NULL);
+
+        g_test_add_func ("/header-sexp/basic", test_header_sexp);
+        g_test_add_func ("/header-sexp/thread", test_header_sexp_thread);
+        g_test_add_func ("/header-sexp/json", test_header_sexp_json);
+
+        return g_test_run ();
+}
+#endif /*BUILD_TESTS*/
@@ -0,0 +1,62 @@
+/*
+** Copyright (C) 2021 Dirk-Jan C. Binnema <djcb@djcbsoftware.nl>
+**
+** This program is free software; you can redistribute it and/or modify it
+** under the terms of the GNU General Public License as published by the
+** Free Software Foundation; either version 3, or (at your option) any
+** later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software Foundation,
+** Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+**
+*/
+
+#ifndef MU_HEADER_SEXP_HH__
+#define MU_HEADER_SEXP_HH__
+
+#include <string>
+#include <xapian.h>
+#include <utils/mu-sexp-writer.hh>
+
+namespace Mu {
+
+struct QueryMatch;
+
+/**
+ * Write the s-expression for the headers of a message, straight from the values
+ * in its Xapian document, i.e., without creating a MuMsg.
+ *
+ * This is equivalent to msg_to_sexp(msg, docid, MU_MSG_OPTION_HEADERS_ONLY),
+ * except that it leaves out :in-reply-to and :list-post, as those would require
+ * opening the message file. With a query-match, the thread information is
+ * included as well.
+ *
+ * @param writer the writer to write to
+ * @param doc the Xapian document for some message
+ * @param docid the docid for this message, or 0
+ * @param qmatch the query-match for the message, or nullptr
+ */
+void write_header_sexp (SexpWriter& writer, const Xapian::Document& doc,
+                        unsigned docid, const QueryMatch* qmatch = nullptr);
+
+/**
+ * Like write_header_sexp(), but only write the properties, so the caller can
+ * add some of its own to the property list.
+ *
+ * @param writer the writer to write to, inside a property list
+ * @param doc the Xapian document for some message
+ * @param docid the docid for this message, or 0
+ * @param qmatch the query-match for the message, or nullptr
+ */
+void write_header_props (SexpWriter& writer, const Xapian::Document& doc,
+                         unsigned docid, const QueryMatch* qmatch = nullptr);
+
+} // namespace Mu
+
+#endif /* MU_HEADER_SEXP_HH__ */
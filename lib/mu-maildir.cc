@@ -23,6 +23,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <dirent.h>
 #include <stdlib.h>
 
 #include <string.h>
@@ -41,24 +42,35 @@ using namespace Mu;
 /* On Linux (and some BSD), we have entry->d_type, but some file
  * systems (XFS, ReiserFS) do not support it, and set it DT_UNKNOWN.
  * On other OSs, notably Solaris, entry->d_type is not present at all.
- * For these cases, we use lstat (in get_dtype) as a slower fallback,
- * and return it in the d_type parameter
+ * For these cases, we use fstatat (in get_dtype) as a slower fallback,
+ * and return it in the d_type parameter. Note that we don't follow
+ * symlinks.
  */
 static unsigned char
-get_dtype (struct dirent* dentry, const char *path, gboolean use_lstat)
+get_dtype (int dfd, struct dirent* dentry)
 {
+	struct stat statbuf;
+
 #ifdef HAVE_STRUCT_DIRENT_D_TYPE
+	if (dentry->d_type != DT_UNKNOWN)
+		return dentry->d_type; /* fastpath */
+#endif /*HAVE_STRUCT_DIRENT_D_TYPE*/
 
-	if (dentry->d_type == DT_UNKNOWN)
-		goto slowpath;
-	if (dentry->d_type == DT_LNK && !use_lstat)
-		goto slowpath;
+	if (fstatat (dfd, dentry->d_name, &statbuf, AT_SYMLINK_NOFOLLOW) != 0) {
+		g_warning ("fstatat failed on %s: %s",
+			   dentry->d_name, g_strerror(errno));
+		return DT_UNKNOWN;
+	}
 
-	return dentry->d_type; /* fastpath */
+	/* we only care about dirs, regular files and links */
+	if (S_ISREG (statbuf.st_mode))
+		return DT_REG;
+	else if (S_ISDIR (statbuf.st_mode))
+		return DT_DIR;
+	else if (S_ISLNK (statbuf.st_mode))
+		return DT_LNK;
 
-slowpath:
-#endif /*HAVE_STRUCT_DIRENT_D_TYPE*/
-	return mu_util_get_dtype (path, use_lstat);
+	return DT_UNKNOWN;
 }
 
 static gboolean
@@ -153,30 +165,38 @@ check_subdir (const char *src, gboolean *in_cur, GError **err)
 	return rv;
 }
 
+/* the name for the link to src: make the filename *cough* unique by
+ * including a hash of the srcname in the targetname. This helps if
+ * there are copies of a message (which all have the same basename) */
+static char*
+get_link_name (const char *src)
+{
+	char *linkname, *srcfile;
+
+	srcfile  = g_path_get_basename (src);
+	linkname = g_strdup_printf ("%u_%s", g_str_hash(src), srcfile);
+	g_free (srcfile);
+
+	return linkname;
+}
+
 static char*
 get_target_fullpath (const char* src, const char *targetpath, GError **err)
 {
-	char *targetfullpath, *srcfile;
+	char *targetfullpath, *linkname;
 	gboolean in_cur;
 
 	if (!check_subdir (src, &in_cur, err))
 		return NULL;
 
-	srcfile = g_path_get_basename (src);
-
-	/* create targetpath; note: make the filename *cough* unique
-	 * by including a hash of the srcname in the targetname. This
-	 * helps if there are copies of a message (which all have the
-	 * same basename)
-	 */
-	targetfullpath = g_strdup_printf ("%s%c%s%c%u_%s",
+	linkname = get_link_name (src);
+	targetfullpath = g_strdup_printf ("%s%c%s%c%s",
 					  targetpath,
 					  G_DIR_SEPARATOR,
 					  in_cur ? "cur" : "new",
 					  G_DIR_SEPARATOR,
-					  g_str_hash(src),
-					  srcfile);
-	g_free (srcfile);
+					  linkname);
+	g_free (linkname);
 
 	return targetfullpath;
 }
@@ -207,6 +227,66 @@ Mu::mu_maildir_link (const char* src, const char *targetpath, GError **err)
 }
 
 
+gboolean
+Mu::mu_maildir_link_many (const std::vector<std::string>& srcs,
+			  const char *targetpath, GError **err)
+{
+	int		dirfds[2] = { -1, -1 }; /* new/, cur/ */
+	unsigned	u;
+	gboolean	rv;
+
+	g_return_val_if_fail (targetpath, FALSE);
+
+	rv = TRUE;
+	for (auto&& src: srcs) {
+
+		gboolean	 in_cur;
+		int		*dfd;
+		char		*linkname;
+
+		if (!check_subdir (src.c_str(), &in_cur, err)) {
+			rv = FALSE;
+			break;
+		}
+
+		/* open the target subdir when we first need it */
+		dfd = &dirfds[in_cur ? 1 : 0];
+		if (*dfd < 0) {
+			/* static buffer */
+			const char *subdir = mu_str_fullpath_s
+				(targetpath, in_cur ? "cur" : "new");
+			*dfd = open (subdir, O_RDONLY | O_DIRECTORY);
+			if (*dfd < 0) {
+				rv = mu_util_g_set_error
+					(err, MU_ERROR_FILE_CANNOT_OPEN,
+					 "failed to open %s: %s",
+					 subdir, g_strerror (errno));
+				break;
+			}
+		}
+
+		linkname = get_link_name (src.c_str());
+		if (symlinkat (src.c_str(), *dfd, linkname) != 0)
+			rv = mu_util_g_set_error
+				(err, MU_ERROR_FILE_CANNOT_LINK,
+				 "error creating link %s%c%s%c%s => %s: %s",
+				 targetpath, G_DIR_SEPARATOR,
+				 in_cur ? "cur" : "new", G_DIR_SEPARATOR,
+				 linkname, src.c_str(), g_strerror (errno));
+		g_free (linkname);
+
+		if (!rv)
+			break;
+	}
+
+	for (u = 0; u != G_N_ELEMENTS(dirfds); ++u)
+		if (dirfds[u] >= 0)
+			close (dirfds[u]);
+
+	return rv;
+}
+
+
 
 /*
  * determine if path is a maildir leaf-dir; ie. if it's 'cur' or 'new'
@@ -243,50 +323,59 @@ Mu::mu_maildir_is_leaf_dir (const char *path)
 }
 
 
+/* note: we do everything relative to the directory's file descriptor,
+ * so the kernel does not need to resolve full paths for each of the
+ * entries. */
 static gboolean
 clear_links (const char *path, DIR *dir)
 {
 	gboolean	 rv;
 	struct dirent	*dentry;
+	int		 dfd;
 
 	rv    = TRUE;
+	dfd   = dirfd (dir);
 	errno = 0;
 
 	while ((dentry = readdir (dir))) {
 
 		guint8	 d_type;
-		char	*fullpath;
 
 		if (dentry->d_name[0] == '.')
 			continue; /* ignore .,.. other dotdirs */
 
-		fullpath = g_build_path ("/", path, dentry->d_name, NULL);
-		d_type	 = get_dtype (dentry, fullpath, TRUE/*lstat*/);
+		d_type = get_dtype (dfd, dentry);
 
 		if (d_type == DT_LNK) {
-			if (unlink (fullpath) != 0 ) {
-				g_warning ("error unlinking %s: %s",
-					   fullpath, g_strerror(errno));
+			if (unlinkat (dfd, dentry->d_name, 0) != 0) {
+				g_warning ("error unlinking %s%c%s: %s",
+					   path, G_DIR_SEPARATOR,
+					   dentry->d_name, g_strerror(errno));
 				rv = FALSE;
 			}
 		} else if (d_type == DT_DIR) {
-			DIR *subdir;
-			subdir = opendir (fullpath);
+			DIR	*subdir;
+			int	 subfd;
+			char	*fullpath;
+
+			fullpath = g_build_path ("/", path, dentry->d_name, NULL);
+			subfd	 = openat (dfd, dentry->d_name,
+					   O_RDONLY | O_DIRECTORY);
+			subdir	 = subfd < 0 ? NULL : fdopendir (subfd);
 			if (!subdir) {
 				g_warning ("failed to open dir %s: %s",
 					   fullpath, g_strerror(errno));
+				if (subfd >= 0)
+					close (subfd);
 				rv = FALSE;
-				goto next;
+			} else {
+				if (!clear_links (fullpath, subdir))
+					rv = FALSE;
+				closedir (subdir); /* closes subfd as well */
 			}
 
-			if (!clear_links (fullpath, subdir))
-				rv = FALSE;
-
-			closedir (subdir);
+			g_free (fullpath);
 		}
-
-	next:
-		g_free (fullpath);
 	}
 
 	return rv;
@@ -23,6 +23,8 @@
 #include <glib.h>
 #include <time.h>
 #include <sys/types.h>          /* for mode_t */
+#include <string>
+#include <vector>
 #include <utils/mu-util.h>
 #include <mu-flags.hh>
 
@@ -64,6 +66,24 @@ gboolean mu_maildir_mkdir (const char* path, mode_t mode, gboolean noindex,
 gboolean mu_maildir_link   (const char* src, const char *targetpath,
 			    GError **err);
 
+/**
+ * create symbolic links to a number of mail messages, as with
+ * mu_maildir_link(), but faster: the links are created relative to
+ * open file descriptors for the target's cur/ and new/ directories,
+ * so their paths do not need to be resolved for each of the links.
+ *
+ * @param srcs the full paths to the source messages
+ * @param targetpath the path to the target maildir (as with
+ * mu_maildir_link())
+ * @param err if function returns FALSE, err may contain extra
+ * information. if err is NULL, does nothing
+ *
+ * @return TRUE if all links were created, FALSE otherwise; we stop
+ * at the first link that cannot be created.
+ */
+gboolean mu_maildir_link_many (const std::vector<std::string>& srcs,
+			       const char *targetpath, GError **err);
+
 /**
  * recursively delete all the symbolic links in a directory tree
  *
@@ -254,15 +254,17 @@ static const MuMsgField FIELD_DATA[] = {
 static MuMsgField* _msg_field_data[MU_MSG_FIELD_ID_NUM];
 static const MuMsgField* mu_msg_field (MuMsgFieldId id)
 {
-	static gboolean _initialized = FALSE;
+	static gsize _initialized = 0;
 
-	/* initialize the array, but only once... */
-	if (G_UNLIKELY(!_initialized)) {
+	/* initialize the array, but only once; this may be called from
+	 * several threads at the same time (e.g., when parsing messages
+	 * in parallel), so use g_once */
+	if (g_once_init_enter (&_initialized)) {
 		int i;
 		for (i = 0; i != G_N_ELEMENTS(FIELD_DATA); ++i)
 			_msg_field_data[FIELD_DATA[i]._id] =
 				(MuMsgField*)&FIELD_DATA[i];
-		_initialized = TRUE;
+		g_once_init_leave (&_initialized, 1);
 	}
 
 	return _msg_field_data[id];
@@ -25,6 +25,8 @@
 #include <stdlib.h>
 #include <ctype.h>
 
+#include <mutex>
+
 #include <gmime/gmime.h>
 
 #include "mu-msg-priv.hh" /* include before mu-msg.h */
@@ -43,21 +45,26 @@ using namespace Mu;
 static gboolean _gmime_initialized = FALSE;
 
 static void
-gmime_init (void)
+gmime_uninit (void)
 {
-	g_return_if_fail (!_gmime_initialized);
+	g_return_if_fail (_gmime_initialized);
 
-	g_mime_init();
-	_gmime_initialized = TRUE;
+	g_mime_shutdown();
+	_gmime_initialized = FALSE;
 }
 
+/* messages may be created from multiple threads at the same time (e.g., in
+ * Store::add_messages), so make sure we initialize only once */
 static void
-gmime_uninit (void)
+gmime_init (void)
 {
-	g_return_if_fail (_gmime_initialized);
+	static std::once_flag once;
 
-	g_mime_shutdown();
-	_gmime_initialized = FALSE;
+	std::call_once (once, []{
+		g_mime_init();
+		_gmime_initialized = TRUE;
+		atexit (gmime_uninit);
+	});
 }
 
 static MuMsg*
@@ -83,10 +90,7 @@ Mu::mu_msg_new_from_file (const char *path, const char *mdir,
 
         start = g_get_monotonic_time();
 
-	if (G_UNLIKELY(!_gmime_initialized)) {
-		gmime_init ();
-		atexit (gmime_uninit);
-	}
+	gmime_init ();
 
 	msgfile = mu_msg_file_new (path, mdir, err);
 	if (!msgfile)
@@ -109,10 +113,7 @@ Mu::mu_msg_new_from_doc (XapianDocument *doc, GError **err)
 
 	g_return_val_if_fail (doc, NULL);
 
-	if (G_UNLIKELY(!_gmime_initialized)) {
-		gmime_init ();
-		atexit (gmime_uninit);
-	}
+	gmime_init ();
 
 	msgdoc = mu_msg_doc_new (doc, err);
 	if (!msgdoc)
@@ -54,8 +54,9 @@ struct MatchDecider : public Xapian::MatchDecider {
                 if (!decider_info_.message_ids.emplace (std::move (msgid)).second)
                         qm.flags |= QueryMatch::Flags::Duplicate;
 
-                const auto path{opt_string (doc, MU_MSG_FIELD_ID_PATH)};
-                if (!path || ::access (path->c_str(), R_OK) != 0)
+                // checking the file-system is expensive; only do so when
+                // we're going to skip unreadable messages.
+                if (any_of (qflags_ & QueryFlags::SkipUnreadable) && !is_readable (doc))
                         qm.flags |= QueryMatch::Flags::Unreadable;
 
                 return qm;
@@ -94,6 +95,24 @@ struct MatchDecider : public Xapian::MatchDecider {
         }
 
         protected:
+        /**
+         * Is the message file for this document readable?
+         *
+         * @param doc a Xapian document
+         *
+         * @return true or false
+         */
+        bool is_readable (const Xapian::Document &doc) const
+        {
+                const auto path{opt_string (doc, MU_MSG_FIELD_ID_PATH)};
+                if (!path)
+                        return false;
+                else if (decider_info_.readable_cache)
+                        return decider_info_.readable_cache->is_readable (*path);
+                else
+                        return ::access (path->c_str(), R_OK) == 0;
+        }
+
         const QueryFlags qflags_;
         DeciderInfo &    decider_info_;
 
@@ -125,10 +144,10 @@ struct MatchDeciderLeader final : public MatchDecider {
          * quickly find that info when doing the second 'related' query.
          *
          * The "leader" query. Matches here get the Leader flag unless their
-         * duplicates / unreadable. We check the duplicate/readable status
-         * regardless of whether SkipDuplicates/SkipUnreadable was passed
-         * (to gather that information); however those flags
-         * affect our true/false verdict.
+         * duplicates / unreadable. We check the duplicate status regardless of
+         * whether SkipDuplicates was passed (to gather that information);
+         * the (more expensive) readable status is only checked with
+         * SkipUnreadable.
          *
          * @param doc xapian document
          *
@@ -136,6 +155,10 @@ struct MatchDeciderLeader final : public MatchDecider {
          */
         bool operator() (const Xapian::Document &doc) const override
         {
+                // Xapian has no way to stop a query half-way, but lets our
+                // exception through.
+                decider_info_.cancel.check();
+
                 // by definition, we haven't seen the docid before,
                 // so no need to search
                 auto it = decider_info_.matches.emplace (doc.get_docid(), make_query_match (doc));
@@ -174,6 +197,8 @@ struct MatchDeciderRelated final : public MatchDecider {
          */
         bool operator() (const Xapian::Document &doc) const override
         {
+                decider_info_.cancel.check();
+
                 // we may have seen this match in the "Leader" query.
                 const auto it = decider_info_.matches.find (doc.get_docid());
                 if (it != decider_info_.matches.end())
@@ -194,32 +219,3 @@ Mu::make_related_decider (QueryFlags qflags, DeciderInfo &info)
 {
         return std::make_unique<MatchDeciderRelated> (qflags, info);
 }
-
-struct MatchDeciderThread final : public MatchDecider {
-        MatchDeciderThread (QueryFlags qflags, DeciderInfo &info) : MatchDecider{qflags, info} {}
-        /**
-         * operator()
-         *
-         * This receives the documents considered during a Xapian query, and
-         * is to return either true (keep) or false (ignore)
-         *
-         * Only include documents that earlier checks have decided to include.
-         *
-         * @param doc xapian document
-         *
-         * @return true or false
-         */
-        bool operator() (const Xapian::Document &doc) const override
-        {
-                // we may have seen this match in the "Leader" query,
-                // or in the second (unbuounded) related query;
-                const auto it{decider_info_.matches.find (doc.get_docid())};
-                return it != decider_info_.matches.end() && !it->second.thread_path.empty();
-        }
-};
-
-std::unique_ptr<Xapian::MatchDecider>
-Mu::make_thread_decider (QueryFlags qflags, DeciderInfo &info)
-{
-        return std::make_unique<MatchDeciderThread> (qflags, info);
-}
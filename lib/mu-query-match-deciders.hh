@@ -28,6 +28,8 @@
 #include <xapian.h>
 
 #include "mu-query-results.hh"
+#include "mu-readable-cache.hh"
+#include "utils/mu-cancel-token.hh"
 
 
 namespace Mu {
@@ -35,9 +37,11 @@ using StringSet = std::unordered_set<std::string>;
 
 
 struct DeciderInfo {
-        QueryMatches matches;
-        StringSet    thread_ids;
-        StringSet    message_ids;
+        QueryMatches   matches;
+        StringSet      thread_ids;
+        StringSet      message_ids;
+        ReadableCache* readable_cache{}; /**< for SkipUnreadable, if any */
+        CancelToken    cancel;           /**< the deciders throw when cancelled */
 };
 
 /**
@@ -67,19 +71,6 @@ std::unique_ptr<Xapian::MatchDecider>  make_related_decider(QueryFlags qflags,
                                                             DeciderInfo& info);
 
 
-/**
- * Make a "thread" decider, that is, a MatchDecider that removes all but the
- * document excepts for the ones found during initial/related searches.
- *
- * @param qflags     query flags
- * @param match_info receives information about the matches.
- *
- * @return a unique_ptr to a match decider.
- */
-std::unique_ptr<Xapian::MatchDecider> make_thread_decider (QueryFlags qflags,
-                                                           DeciderInfo& info);
-
-
 } // namepace Mu
 
 #endif /* MU_QUERY_MATCH_DECIDERS_HH__ */
@@ -21,10 +21,12 @@
 #define MU_QUERY_RESULTS_HH__
 
 #include <algorithm>
+#include <cstdint>
 #include <limits>
 #include <string>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
 #include <limits>
 #include <ostream>
 #include <cmath>
@@ -63,6 +65,119 @@ enum struct QueryFlags {
 };
 MU_ENABLE_BITOPS (QueryFlags);
 
+/// The position of a message in its thread, as a sequence of segments (one per
+/// thread-level). The segments are packed as fixed-width big-endian integers,
+/// so that thread-paths sort correctly with a plain byte-wise comparison. Only
+/// when needed, they are rendered as strings of colon-separated hex-numbers,
+/// e.g. "00:01:0a".
+class ThreadPath
+{
+        public:
+        ThreadPath() = default;
+
+        /**
+         * Construct a ThreadPath
+         *
+         * @param packed segments, packed with append()
+         * @param digits the number of hex-digits per segment
+         * @param descending whether this is for descending sorting; if so,
+         * the path sorts _after_ all paths for which it is a prefix (so, after
+         * reversing, parents still come before their children). As a string,
+         * this is marked with a ":z" suffix.
+         */
+        ThreadPath (std::string &&packed, size_t digits, bool descending)
+            : packed_{std::move (packed)}, digits_{static_cast<uint8_t> (digits)},
+              descending_{descending}
+        {
+                if (descending_)
+                        packed_ += static_cast<char> (0xff); // > any segment's first byte
+        }
+
+        /**
+         * Append a segment to some packed path
+         *
+         * @param packed a packed path
+         * @param segment segment to append, < 16^digits
+         * @param digits the number of hex-digits per segment
+         */
+        static void append (std::string &packed, unsigned segment, size_t digits)
+        {
+                // note: one byte more than strictly needed for even number of
+                // digits, so the first byte is always < 0xff
+                for (auto i = width (digits); i != 0; --i)
+                        packed += static_cast<char> (
+                            (static_cast<uint64_t> (segment) >> (8 * (i - 1))) & 0xff);
+        }
+
+        /**
+         * Is this path empty?
+         *
+         * @return true or false
+         */
+        bool empty() const { return packed_.empty(); }
+
+        /**
+         * Get the packed path, which can be compared byte-wise (e.g., with
+         * memcmp)
+         *
+         * @return the packed path
+         */
+        const std::string &packed() const { return packed_; }
+
+        /**
+         * Get the string representation of this path
+         *
+         * @return the thread-path string
+         */
+        std::string to_string() const
+        {
+                static constexpr char hexchars[] = "0123456789abcdef";
+
+                std::string str;
+                const auto  w{width (digits_)};
+                const auto  len{packed_.size() - (descending_ ? 1 : 0)};
+
+                for (size_t pos = 0; pos + w <= len; pos += w) {
+                        uint64_t segm{};
+                        for (size_t i = 0; i != w; ++i)
+                                segm = (segm << 8) | static_cast<unsigned char> (packed_[pos + i]);
+
+                        char   buf[16];
+                        size_t n{0};
+                        do {
+                                buf[n++] = hexchars[segm & 0xf];
+                                segm >>= 4;
+                        } while (segm != 0 || n < digits_);
+
+                        if (pos != 0)
+                                str += ':';
+                        while (n != 0)
+                                str += buf[--n];
+                }
+
+                if (descending_)
+                        str += ":z";
+
+                return str;
+        }
+
+        bool operator< (const ThreadPath &rhs) const { return packed_ < rhs.packed_; }
+
+        private:
+        static size_t width (size_t digits) { return digits / 2 + 1; }
+
+        std::string packed_;
+        uint8_t     digits_{};
+        bool        descending_{};
+};
+
+inline std::ostream &
+operator<< (std::ostream &os, const ThreadPath &tpath)
+{
+        os << tpath.to_string();
+        return os;
+}
+
 /// Stores all the essential information for sorting the results.
 struct QueryMatch {
         /// Flags for a match (message) found
@@ -91,7 +206,7 @@ struct QueryMatch {
         // otherwise, it is empty.
         std::string subject;        /**< subject for this message */
         size_t      thread_level{}; /**< The thread level */
-        std::string thread_path;    /**< The hex-numerial path in the thread, ie. '00:01:0a' */
+        ThreadPath  thread_path;    /**< The path in the thread */
         std::string thread_date;    /**< date of newest message in thread */
 
         bool operator< (const QueryMatch &rhs) const { return date_key < rhs.date_key; }
@@ -140,6 +255,9 @@ operator<< (std::ostream &os, QueryMatch::Flags mflags)
 
 using QueryMatches = std::unordered_map<Xapian::docid, QueryMatch>;
 
+/// An ordering of (some of) the items in an MSet, as their indices.
+using MSetOrder = std::vector<Xapian::doccount>;
+
 inline std::ostream &
 operator<< (std::ostream &os, const QueryMatch &qmatch)
 {
@@ -170,6 +288,20 @@ class QueryResultsIterator
             : mset_it_{mset_it}, query_matches_{query_matches}
         {
         }
+        /**
+         * Construct an iterator that visits the MSet items in the given order
+         *
+         * @param mset the MSet
+         * @param order the order, as indices in mset
+         * @param pos position in order
+         * @param query_matches the query matches
+         */
+        QueryResultsIterator (const Xapian::MSet &mset, const MSetOrder &order, size_t pos,
+                              QueryMatches &query_matches)
+            : mset_it_{pos < order.size() ? mset[order[pos]] : mset.end()}, mset_{mset},
+              order_{&order}, pos_{pos}, query_matches_{query_matches}
+        {
+        }
         ~QueryResultsIterator() { g_clear_pointer (&msg_, mu_msg_unref); }
 
         /**
@@ -179,7 +311,13 @@ class QueryResultsIterator
          */
         QueryResultsIterator &operator++()
         {
-                ++mset_it_;
+                if (!order_)
+                        ++mset_it_;
+                else if (++pos_ < order_->size())
+                        mset_it_ = mset_[(*order_)[pos_]];
+                else
+                        mset_it_ = mset_.end();
+
                 return *this;
         }
 
@@ -190,8 +328,11 @@ class QueryResultsIterator
          *
          * @return true or false
          */
-        bool operator== (const QueryResultsIterator &rhs) const { return mset_it_ == rhs.mset_it_; }
-        bool operator!= (const QueryResultsIterator &rhs) const { return mset_it_ != rhs.mset_it_; }
+        bool operator== (const QueryResultsIterator &rhs) const
+        {
+                return order_ ? pos_ == rhs.pos_ : mset_it_ == rhs.mset_it_;
+        }
+        bool operator!= (const QueryResultsIterator &rhs) const { return !(*this == rhs); }
 
         QueryResultsIterator &      operator*() { return *this; }
         const QueryResultsIterator &operator*() const { return *this; }
@@ -329,6 +470,9 @@ k         * destroyed.; it's a 'floating' reference.
 
         private:
         Xapian::MSetIterator mset_it_;
+        Xapian::MSet         mset_;     /**< only with order_ */
+        const MSetOrder *    order_{};  /**< custom order, if any */
+        size_t               pos_{};    /**< position in order_ */
         QueryMatches &       query_matches_;
         MuMsg *              msg_{};
 };
@@ -351,38 +495,56 @@ class QueryResults
             : mset_{mset}, query_matches_{std::move (query_matches)}
         {
         }
+
+        /**
+         * Construct a QueryResults object, with the results in a custom order.
+         *
+         * @param mset an Xapian::MSet with matches
+         * @param order the order of the results, as indices in mset; items not
+         * in order are not part of the results.
+         */
+        QueryResults (const Xapian::MSet &mset, QueryMatches &&query_matches, MSetOrder &&order)
+            : mset_{mset}, query_matches_{std::move (query_matches)}, order_{std::move (order)}
+        {
+        }
+
         /**
          * Is this QueryResults object empty (ie., no matches)?
          *
          * @return true are false
          */
-        bool empty() const { return mset_.empty(); }
+        bool empty() const { return size() == 0; }
 
         /**
          * Get the number of matches in this QueryResult
          *
          * @return number of matches
          */
-        size_t size() const { return mset_.size(); }
+        size_t size() const { return order_ ? order_->size() : mset_.size(); }
 
         /**
          * Get the begin iterator to the results.
          *
          * @return iterator
          */
-        iterator       begin() { return QueryResultsIterator (mset_.begin(), query_matches_); }
-        const iterator begin() const
-        {
-                return QueryResultsIterator (mset_.begin(), query_matches_);
-        }
+        iterator       begin() { return make_iterator (true); }
+        const iterator begin() const { return make_iterator (true); }
 
         /**
          * Get the end iterator to the results.
          *
          * @return iterator
          */
-        iterator       end() { return QueryResultsIterator (mset_.end(), query_matches_); }
-        const_iterator end() const { return QueryResultsIterator (mset_.end(), query_matches_); }
+        iterator       end() { return make_iterator (false); }
+        const_iterator end() const { return make_iterator (false); }
+
+        /**
+         * Get the underlying MSet. Note that with a custom order, this may
+         * have more items than the results.
+         *
+         * @return the mset
+         */
+        const Xapian::MSet &mset() const { return mset_; }
 
         /**
          * Get the query-matches for these QueryResults. The non-const
@@ -395,8 +557,19 @@ class QueryResults
         QueryMatches &      query_matches() { return query_matches_; }
 
         private:
+        iterator make_iterator (bool begin) const
+        {
+                if (order_)
+                        return QueryResultsIterator (mset_, *order_, begin ? 0 : order_->size(),
+                                                     query_matches_);
+                else
+                        return QueryResultsIterator (begin ? mset_.begin() : mset_.end(),
+                                                     query_matches_);
+        }
+
         const Xapian::MSet   mset_;
         mutable QueryMatches query_matches_;
+        Option<MSetOrder>    order_;
 };
 
 } // namespace Mu
@@ -20,11 +20,12 @@
 #include "mu-query-threads.hh"
 #include "mu-msg-fields.h"
 
-#include <set>
-#include <unordered_set>
-#include <list>
+#include <algorithm>
+#include <limits>
 #include <cassert>
 #include <cstring>
+#include <cstdlib>
+#include <cmath>
 #include <iostream>
 #include <iomanip>
 
@@ -33,47 +34,21 @@
 
 using namespace Mu;
 
-struct Container {
-        using Containers = std::vector<Container*>;
+// The threader works on a flat arena of containers, which refer to each other
+// through 32-bit ids (i.e., indices in the arena); message-ids are interned, so
+// that (rather than having a std::string-keyed map with a node per message) we
+// only need a handful of allocations, regardless of the number of messages.
 
-        Container() = default;
-        Container(Option<QueryMatch&> msg): query_match{msg} {}
-        Container(const Container&) = delete;
-        Container(Container&&) = default;
+using ContainerId = uint32_t;
+constexpr auto NoContainer = std::numeric_limits<ContainerId>::max();
 
-        void add_child (Container& new_child) {
-               new_child.parent = this;
-               children.emplace_back(&new_child);
-        }
-        void remove_child (Container& child) {
-                children.erase(find_child(child));
-                assert(!has_child(child));
-        }
+// date key for messages without a date; sorts before all others.
+constexpr auto NoDate = std::numeric_limits<int64_t>::min();
 
-        Containers::iterator find_child (Container& child) {
-                return std::find_if(children.begin(), children.end(),
-                                 [&](auto&& c){ return c == &child; });
-        }
-        Containers::const_iterator find_child (Container& child) const {
-                return std::find_if(children.begin(), children.end(),
-                                 [&](auto&& c){ return c == &child; });
-        }
-        bool has_child (Container& child) const {
-                return find_child(child) != children.cend();
-        }
+struct Container {
+        Container() = default;
+        Container(Option<QueryMatch&> msg): query_match{msg} {}
 
-        bool is_reachable(Container* other) const {
-                auto up{ur_parent()};
-                return up && up == other->ur_parent();
-        }
-        template <typename Func> void for_each_child (Func&& func) {
-                auto it{children.rbegin()};
-                while (it != children.rend()) {
-                        auto next = std::next(it);
-                        func(*it);
-                        it = next;
-                }
-        }
         // During sorting, this is the cached value for the (recursive) date-key
         // of this container -- ie.. either the one from the first of its
         // children, or from its query-match, if it has no children.
@@ -81,82 +56,297 @@ struct Container {
         // Note that the sub-root-levels of threads are always sorted by date,
         // in ascending order, regardless of whatever sorting was specified for
         // the root-level.
+        int64_t              thread_date_key{NoDate};
 
+        Option<QueryMatch&>  query_match;
+        bool                 is_nuked{};
+        ContainerId          parent{NoContainer};
+
+        // while building, the children form a doubly-linked list...
+        ContainerId          first_child{NoContainer};
+        ContainerId          last_child{NoContainer};
+        ContainerId          prev_sibling{NoContainer};
+        ContainerId          next_sibling{NoContainer};
+        uint32_t             child_num{};
+
+        // ... and when sorting, a range in Threader::children_
+        uint32_t             children_begin{};
+        uint32_t             children_end{};
+};
 
-        std::string thread_date_key;
+static int64_t
+date_key (const std::string& date)
+{
+        return date.empty() ? NoDate : ::strtoll(date.c_str(), {}, 10);
+}
 
+static std::string
+date_key_to_string (int64_t key)
+{
+        return key == NoDate ? "" : date_to_time_t_string(key);
+}
 
-        Option<QueryMatch&>  query_match;
-        bool                 is_nuked{};
-        Container*           parent{};
-        Containers           children;
+class Threader {
+public:
+        /**
+         * Construct a Threader
+         *
+         * @param n expected number of messages
+         */
+        Threader (size_t n);
 
-        using ContainerVec = std::vector<Container*>;
+        template <typename QueryResultsType> void add_matches (QueryResultsType& qres,
+                                                               const CancelToken& cancel);
+        void prune_empty_containers ();
+        void sort_siblings (bool descending);
+        void update_query_matches ();
+
+        friend std::ostream& operator<<(std::ostream& os, const Threader& threader);
 
 private:
-        const Container* ur_parent() const  {
-                assert(this->parent != this);
-                return parent ? parent->ur_parent() : this;
-        }
+        ContainerId intern (const std::string& msgid);
+        size_t      find_slot (const std::string& msgid, uint64_t hash) const;
+        ContainerId find (const std::string& msgid) const;
+        ContainerId add_container (Option<QueryMatch&> qm = Nothing);
+        void        grow_slots ();
+
+        ContainerId ur_parent (ContainerId id);
+        bool is_reachable (ContainerId id1, ContainerId id2);
+        void add_child (ContainerId parent_id, ContainerId child_id);
+        void remove_child (ContainerId parent_id, ContainerId child_id);
+        void prune (ContainerId child_id);
+        bool prune_empty_containers (ContainerId id);
+        bool should_prune (ContainerId id) const;
+
+        void sort_container (ContainerId id);
+
+        bool update_container (ContainerId id, bool descending, std::string& tpath,
+                               size_t level, size_t seg_size,
+                               const std::string& prev_subject = "");
+        void update_containers (ContainerId id, bool descending, std::string& tpath,
+                                size_t level, size_t seg_size, std::string& prev_subject);
+
+        Container& container (ContainerId id)             { return containers_[id]; }
+        const Container& container (ContainerId id) const { return containers_[id]; }
+
+        std::vector<Container>   containers_; /**< the arena */
+        std::vector<ContainerId> children_;   /**< children, as ranges */
+        std::vector<ContainerId> roots_;      /**< the root set (after sorting) */
+        std::vector<ContainerId> walk_;       /**< scratch space for walking a thread */
+
+        // interned message-ids; for each container, the span of its
+        // message-id in ids_ (or empty for duplicates)
+        struct Span { uint32_t offset; uint32_t len; };
+        std::string              ids_;
+        std::vector<Span>        spans_;
+        // open-addressing hash table; we keep (part of) the hash with the
+        // id, so we rarely need to look at the message-id itself.
+        struct Slot { ContainerId id; uint32_t hash; };
+        std::vector<Slot>        slots_;
+        size_t                   num_ids_{};
+
+        std::vector<std::pair<std::string, Option<QueryMatch&>>> dups_;
+
+        // union-find, for the threads (trees) the containers belong to while
+        // building them; that is, only until we start pruning.
+        std::vector<ContainerId> uf_parents_;
+        std::vector<uint32_t>    uf_sizes_;
 };
 
-using Containers   = Container::Containers;
-using ContainerVec = Container::ContainerVec;
-
-static std::ostream&
-operator<<(std::ostream& os, const Container& container)
+static uint64_t // FNV-1a
+hash_id (const char *str, size_t len)
 {
-        os << "container: " << std::right << std::setw(10) << &container
-           << ": parent: "  << std::right << std::setw(10) << container.parent
-           << " [" << container.thread_date_key << "]"
-           << "\n  children: ";
+        uint64_t h{0xcbf29ce484222325ULL};
+        for (size_t i = 0; i != len; ++i)
+                h = (h ^ static_cast<unsigned char>(str[i])) * 0x100000001b3ULL;
+        return h;
+}
 
-        for (auto&& c: container.children)
-                os << std::right << std::setw(10) << c << " ";
+Threader::Threader(size_t n)
+{
+        // each message typically brings a few references of its own.
+        containers_.reserve(2 * n);
+        spans_.reserve(2 * n);
+        uf_parents_.reserve(2 * n);
+        uf_sizes_.reserve(2 * n);
+        ids_.reserve(2 * n * 48);
+
+        size_t slots{16};
+        while (slots < 4 * n)
+                slots *= 2;
+        slots_.assign(slots, {NoContainer, 0});
+}
 
-        os << (container.is_nuked ? " nuked" : "");
+ContainerId
+Threader::add_container (Option<QueryMatch&> qm)
+{
+        const auto id{static_cast<ContainerId>(containers_.size())};
 
-        if (container.query_match)
-                os << "\n  " << container.query_match.value();
+        containers_.emplace_back(qm);
+        spans_.push_back({0, 0});
+        uf_parents_.emplace_back(id);
+        uf_sizes_.emplace_back(1);
 
-        return os;
+        return id;
 }
 
+void
+Threader::grow_slots()
+{
+        slots_.assign(slots_.size() * 2, {NoContainer, 0});
+        const auto mask{slots_.size() - 1};
 
-using IdTable = std::unordered_map<std::string, Container>;
-using DupTable = std::multimap<std::string, Container>;
+        for (ContainerId id = 0; id != spans_.size(); ++id) {
+                const auto& span{spans_[id]};
+                if (span.len == 0)
+                        continue;
+                const auto hash{hash_id(ids_.data() + span.offset, span.len)};
+                auto idx{hash & mask};
+                while (slots_[idx].id != NoContainer)
+                        idx = (idx + 1) & mask;
+                slots_[idx] = {id, static_cast<uint32_t>(hash)};
+        }
+}
 
-static void
-handle_duplicates (IdTable& id_table, DupTable& dup_table)
+// find the slot for msgid; either the one with its container, or the empty one
+// where it should go.
+size_t
+Threader::find_slot (const std::string& msgid, uint64_t hash) const
 {
-        size_t n{};
+        const auto mask{slots_.size() - 1};
+        auto idx{hash & mask};
 
-        for (auto&& dup: dup_table) {
-                const auto msgid{dup.first};
-                auto it = id_table.find(msgid);
-                if (it == id_table.end())
+        for (; slots_[idx].id != NoContainer; idx = (idx + 1) & mask) {
+                if (slots_[idx].hash != static_cast<uint32_t>(hash))
                         continue;
+                const auto& span{spans_[slots_[idx].id]};
+                if (span.len == msgid.size() &&
+                    ::memcmp(ids_.data() + span.offset, msgid.data(), span.len) == 0)
+                        break;
+        }
+
+        return idx;
+}
+
+ContainerId
+Threader::find (const std::string& msgid) const
+{
+        return slots_[find_slot(msgid, hash_id(msgid.data(), msgid.size()))].id;
+}
+
+// find the container for msgid, or create an empty one.
+ContainerId
+Threader::intern (const std::string& msgid)
+{
+        assert(!msgid.empty());
 
-                // add duplicates as fake children
-                char buf[32];
-                ::snprintf(buf, sizeof(buf), "dup-%zu", ++n);
-                it->second.add_child(
-                        id_table.emplace(buf, std::move(dup.second)).first->second);
+        const auto hash{hash_id(msgid.data(), msgid.size())};
+        auto idx{find_slot(msgid, hash)};
+        if (slots_[idx].id != NoContainer)
+                return slots_[idx].id;
+
+        if (2 * (num_ids_ + 1) > slots_.size()) {
+                grow_slots();
+                idx = find_slot(msgid, hash);
+        }
+
+        const auto new_id{add_container()};
+        spans_[new_id] = { static_cast<uint32_t>(ids_.size()),
+                           static_cast<uint32_t>(msgid.size()) };
+        ids_ += msgid;
+
+        slots_[idx] = {new_id, static_cast<uint32_t>(hash)};
+        ++num_ids_;
+
+        return new_id;
+}
+
+// Get the representative of the thread a container belongs to; this is not
+// necessarily the thread's root container, but it is the same for all
+// containers in the thread.
+ContainerId
+Threader::ur_parent (ContainerId id)
+{
+        while (uf_parents_[id] != id) {
+                uf_parents_[id] = uf_parents_[uf_parents_[id]]; // path halving
+                id = uf_parents_[id];
         }
+
+        return id;
+}
+
+bool
+Threader::is_reachable (ContainerId id1, ContainerId id2)
+{
+        return ur_parent(id1) == ur_parent(id2);
+}
+
+void
+Threader::add_child (ContainerId parent_id, ContainerId child_id)
+{
+        auto& parent{container(parent_id)};
+        auto& child{container(child_id)};
+
+        child.parent       = parent_id;
+        child.prev_sibling = parent.last_child;
+        child.next_sibling = NoContainer;
+
+        if (parent.last_child != NoContainer)
+                container(parent.last_child).next_sibling = child_id;
+        else
+                parent.first_child = child_id;
+
+        parent.last_child = child_id;
+        ++parent.child_num;
+
+        // merge the threads (union by size)
+        auto up1{ur_parent(parent_id)}, up2{ur_parent(child_id)};
+        if (up1 != up2) {
+                if (uf_sizes_[up1] < uf_sizes_[up2])
+                        std::swap(up1, up2);
+                uf_parents_[up2]  = up1;
+                uf_sizes_[up1]   += uf_sizes_[up2];
+        }
+}
+
+void
+Threader::remove_child (ContainerId parent_id, ContainerId child_id)
+{
+        auto& parent{container(parent_id)};
+        auto& child{container(child_id)};
+
+        assert(child.parent == parent_id);
+
+        if (child.prev_sibling != NoContainer)
+                container(child.prev_sibling).next_sibling = child.next_sibling;
+        else
+                parent.first_child = child.next_sibling;
+
+        if (child.next_sibling != NoContainer)
+                container(child.next_sibling).prev_sibling = child.prev_sibling;
+        else
+                parent.last_child = child.prev_sibling;
+
+        child.prev_sibling = child.next_sibling = NoContainer;
+        --parent.child_num;
 }
 
 template <typename QueryResultsType>
-static IdTable
-determine_id_table (QueryResultsType& qres)
+void
+Threader::add_matches (QueryResultsType& qres, const CancelToken& cancel)
 {
+        size_t n{};
+
         // 1. For each query_match
-        IdTable id_table;
-        DupTable dups;
         for (auto&& mi: qres) {
+                // getting the message-ids etc. is the expensive part.
+                if (++n % 1024 == 0)
+                        cancel.check();
+
                 const auto msgid{mi.message_id().value_or(*mi.path())};
                 // Step 0 (non-JWZ): filter out dups, handle those at the end
                 if (mi.query_match().has_flag(QueryMatch::Flags::Duplicate)) {
-                        dups.emplace(msgid, mi.query_match());
+                        dups_.emplace_back(msgid, mi.query_match());
                         continue;
                 }
                 // 1.A If id_table contains an empty Container for this ID:
@@ -164,47 +354,38 @@ determine_id_table (QueryResultsType& qres)
                 // Else:
                 //   Create a new Container object holding this query_match (query-match);
                 //  Index the Container by Query_Match-ID
-                auto c_it = id_table.find(msgid);
-                auto& container = [&]()->Container& {
-                        if (c_it != id_table.end()) {
-                                if (!c_it->second.query_match) // hmm, dup?
-                                        c_it->second.query_match = mi.query_match();
-                                return c_it->second;
-                        } else {
-                                // Else:
-                                // Create a new Container object holding this query_match (query-match);
-                                // Index the Container by Query_Match-ID
-                                return id_table.emplace(msgid, mi.query_match()).first->second;
-                        }
-                }();
-
-                // We sort by date (ascending), *except* for the root; we don't
-                // know what query_matchs will be at the root level yet, so remember
-                // both. Moreover, even when sorting the top-level in descending
-                // order, still sort the thread levels below that in ascending
-                // order.
-                container.thread_date_key = container.query_match->date_key =
-                        mi.date().value_or("");
-                // initial guess for the thread-date; might be updated
-                // later.
-
-                // remember the subject, we use it to determine the (sub)thread subject
-                container.query_match->subject  = mi.subject().value_or("");
+                const auto id{intern(msgid)};
+                {
+                        auto& c{container(id)};
+                        if (!c.query_match) // hmm, dup?
+                                c.query_match = mi.query_match();
+
+                        // We sort by date (ascending), *except* for the root;
+                        // we don't know what query_matchs will be at the root
+                        // level yet, so remember both. Moreover, even when
+                        // sorting the top-level in descending order, still sort
+                        // the thread levels below that in ascending order.
+                        c.query_match->date_key = mi.date().value_or("");
+                        c.thread_date_key       = date_key(c.query_match->date_key);
+                        // initial guess for the thread-date; might be updated
+                        // later.
+
+                        // remember the subject, we use it to determine the
+                        // (sub)thread subject
+                        c.query_match->subject = mi.subject().value_or("");
+                }
 
                 // 1.B
                 // For each element in the query_match's References field:
-                Container* parent_ref_container{};
+                ContainerId parent_ref_id{NoContainer};
                 for (const auto& ref: mi.references()) {
                         //   grand_<n>-parent -> grand_<n-1>-parent -> ... -> parent.
+                        if (ref.empty())
+                                continue;
 
                         // Find a Container object for the given Query_Match-ID; If it exists, use it;
                         // otherwise make one with a null Query_Match.
-                        auto ref_container = [&]()->Container* {
-                                auto ref_it = id_table.find(ref);
-                                if (ref_it == id_table.end())
-                                        ref_it = id_table.emplace(ref,Nothing).first;
-                                return &ref_it->second;
-                        }();
+                        const auto ref_id{intern(ref)};
 
                         // Link the References field's Containers together in the order implied
                         // by the References header.
@@ -215,29 +396,26 @@ determine_id_table (QueryResultsType& qres)
                         //   reachable, and also search down the children of A to see if B is
                         //   reachable. If either is already reachable as a child of the other,
                         //   don't add the link.
-                        if (parent_ref_container && !ref_container->parent) {
-                                if (!parent_ref_container->is_reachable(ref_container))
-                                        parent_ref_container->add_child(*ref_container);
-                                // else
-                                //         g_message ("%u: reachable %s -> %s", __LINE__, msgid.c_str(), ref.c_str());
-                        }
-
-                        parent_ref_container = ref_container;
+                        if (parent_ref_id != NoContainer &&
+                            container(ref_id).parent == NoContainer &&
+                            !is_reachable(parent_ref_id, ref_id))
+                                add_child(parent_ref_id, ref_id);
+
+                        parent_ref_id = ref_id;
                 }
 
                 // Add the query_match to the chain.
-                if (parent_ref_container && !container.parent) {
-                        if (!parent_ref_container->is_reachable(&container))
-                                parent_ref_container->add_child(container);
-                        // else
-                        //         g_message ("%u: reachable %s -> parent", __LINE__, msgid.c_str());
-                }
+                if (parent_ref_id != NoContainer && container(id).parent == NoContainer &&
+                    !is_reachable(parent_ref_id, id))
+                        add_child(parent_ref_id, id);
         }
 
-        // non-JWZ: add duplicate messages.
-        handle_duplicates (id_table, dups);
-
-        return id_table;
+        // non-JWZ: add duplicate messages as fake children
+        for (auto&& dup: dups_) {
+                const auto id{find(dup.first)};
+                if (id != NoContainer)
+                        add_child(id, add_container(dup.second));
+        }
 }
 
 /// Recursively walk all containers under the root set.
@@ -277,40 +455,72 @@ determine_id_table (QueryResultsType& qres)
 ///     Do not promote the children if doing so would promote them to the root
 ///     set -- unless there is only one child, in which case, do.
 
-static void
-prune (Container* child)
+void
+Threader::prune (ContainerId child_id)
 {
-        Container *container{child->parent};
-
-        for (auto& grandchild: child->children) {
-                grandchild->parent = container;
-                if (container)
-                        container->children.emplace_back(grandchild);
+        const auto parent_id{container(child_id).parent};
+
+        auto grandchild_id{container(child_id).first_child};
+        while (grandchild_id != NoContainer) {
+                auto& grandchild{container(grandchild_id)};
+                const auto next{grandchild.next_sibling};
+                if (parent_id != NoContainer)
+                        add_child(parent_id, grandchild_id);
+                else {
+                        grandchild.parent       = NoContainer;
+                        grandchild.prev_sibling = grandchild.next_sibling = NoContainer;
+                }
+                grandchild_id = next;
         }
 
-        child->children.clear();
-        child->is_nuked = true;
+        auto& child{container(child_id)};
+        child.first_child = child.last_child = NoContainer;
+        child.child_num   = 0;
+        child.is_nuked    = true;
 
-        if (container)
-                container->remove_child(*child);
+        if (parent_id != NoContainer)
+                remove_child(parent_id, child_id);
 }
 
-
-static bool
-prune_empty_containers (Container& container)
+bool
+Threader::prune_empty_containers (ContainerId id)
 {
-        Containers to_prune;
+        // depth-first, children before their parents. Threads can be very
+        // deep, so rather than recursing, keep a stack; for each container on
+        // it, the child to visit next. We walk the children backwards, so the
+        // ones spliced in at the end are not visited again.
+        struct Frame { ContainerId id; ContainerId next_child; };
+        std::vector<Frame> stack{{id, container(id).last_child}};
+
+        while (true) {
+                auto& frame{stack.back()};
+                if (frame.next_child != NoContainer) {
+                        const auto child_id{frame.next_child};
+                        stack.push_back({child_id, container(child_id).last_child});
+                        continue;
+                }
 
-        container.for_each_child([&](auto& child){
-                if (prune_empty_containers(*child))
-                        to_prune.emplace_back(child);
-        });
+                // all children are done; now this one.
+                const auto done_id{frame.id};
+                const auto prune_it{should_prune(done_id)};
+                stack.pop_back();
+                if (stack.empty())
+                        return prune_it;
+
+                const auto prev{container(done_id).prev_sibling};
+                if (prune_it)
+                        prune(done_id);
+                stack.back().next_child = prev;
+        }
+}
 
-        for (auto& child: to_prune)
-                prune (child);
+bool
+Threader::should_prune (ContainerId id) const
+{
+        const auto& c{container(id)};
 
         // Never nuke these.
-        if (container.query_match)
+        if (c.query_match)
                 return false;
 
         // If it is an empty container with no children, nuke it.
@@ -321,25 +531,24 @@ prune_empty_containers (Container& container)
         //
         // Do not promote the children if doing so would promote them to the root
         // set -- unless there is only one child, in which case, do.
-        //const auto rootset_child{!container.parent->parent};
-        if (container.parent || container.children.size() <= 1)
+        if (c.parent != NoContainer || c.child_num <= 1)
                 return true; // splice/nuke it.
 
         return false;
 }
 
-
-static void
-prune_empty_containers (IdTable& id_table)
+void
+Threader::prune_empty_containers ()
 {
-        for (auto&& item: id_table) {
-
-                auto& child(item.second);
-                if (child.parent)
+        // note: children promoted to the root set are visited again; that is
+        // harmless, since their subtrees are pruned already.
+        for (ContainerId id = 0; id != containers_.size(); ++id) {
+                const auto& c{container(id)};
+                if (c.parent != NoContainer || c.is_nuked)
                         continue; // not a root child.
 
-                if (prune_empty_containers(item.second))
-                        prune(&child);
+                if (prune_empty_containers(id))
+                        prune(id);
         }
 }
 
@@ -348,24 +557,6 @@ prune_empty_containers (IdTable& id_table)
 //
 
 
-/// Register some information about a match (i.e., message) that we can use for
-/// subsequent queries.
-using ThreadPath = std::vector<unsigned>;
-inline std::string
-to_string (const ThreadPath& tpath, size_t digits)
-{
-        std::string str;
-        str.reserve(tpath.size() * digits);
-
-        bool first{true};
-        for (auto&& segm: tpath) {
-                str   += format("%s%0*x", first ? "" : ":", (int)digits, segm);
-                first  = false;
-        }
-
-        return str;
-}
-
 static bool // compare subjects, ignore anything before the last ':<space>*'
 subject_matches (const std::string& sub1, const std::string& sub2)
 {
@@ -383,137 +574,157 @@ subject_matches (const std::string& sub1, const std::string& sub2)
 	return g_strcmp0(search_str(sub1), search_str(sub2)) == 0;
 }
 
-static bool
-update_container (Container& container, bool descending,
-                  ThreadPath& tpath, size_t seg_size,
-                  const std::string& prev_subject="")
+bool
+Threader::update_container (ContainerId id, bool descending,
+                            std::string& tpath, size_t level, size_t seg_size,
+                            const std::string& prev_subject)
 {
-        if (!container.children.empty()) {
-                Container* first = container.children.front();
-                if (first->query_match)
-                        first->query_match->flags |= QueryMatch::Flags::First;
-                Container* last  = container.children.back();
-                if (last->query_match)
-                        last->query_match->flags |= QueryMatch::Flags::Last;
+        auto& c{container(id)};
+
+        if (c.children_begin != c.children_end) {
+                auto& first{container(children_[c.children_begin])};
+                if (first.query_match)
+                        first.query_match->flags |= QueryMatch::Flags::First;
+                auto& last{container(children_[c.children_end - 1])};
+                if (last.query_match)
+                        last.query_match->flags |= QueryMatch::Flags::Last;
         }
 
-        if (!container.query_match)
+        if (!c.query_match)
                 return false; // nothing else to do.
 
-        auto& qmatch(*container.query_match);
-        if (!container.parent)
+        auto& qmatch(*c.query_match);
+        if (c.parent == NoContainer)
                 qmatch.flags |= QueryMatch::Flags::Root;
-        else if (!container.parent->query_match)
+        else if (!container(c.parent).query_match)
                 qmatch.flags |= QueryMatch::Flags::Orphan;
 
-        if (!container.children.empty())
+        if (c.children_begin != c.children_end)
                 qmatch.flags |= QueryMatch::Flags::HasChild;
 
         if (qmatch.has_flag(QueryMatch::Flags::Root) || prev_subject.empty() ||
 	    !subject_matches(prev_subject, qmatch.subject))
                 qmatch.flags |= QueryMatch::Flags::ThreadSubject;
 
-        if (descending && container.parent) {
-                // trick xapian by giving it "inverse" sorting key so our
-                // ascending-date sorted threads stay in that order
-                tpath.back() = ((1U << (4 * seg_size)) - 1) - tpath.back();
-        }
-
-        qmatch.thread_path  = to_string(tpath, seg_size);
-        qmatch.thread_level = tpath.size() - 1;
-
-        // ensure thread root comes before its children
-        if (descending)
-                qmatch.thread_path += ":z";
+        // note: with descending, ThreadPath ensures that the thread root
+        // comes before its children
+        qmatch.thread_path  = ThreadPath{std::string{tpath}, seg_size, descending};
+        qmatch.thread_level = level;
 
         return true;
 }
 
 
-static void
-update_containers (Containers& children, bool descending, ThreadPath& tpath,
-                   size_t seg_size, std::string& prev_subject)
+void
+Threader::update_containers (ContainerId id, bool descending, std::string& tpath,
+                             size_t level, size_t seg_size, std::string& prev_subject)
 {
-        size_t idx{0};
+        const auto max_segm{(1U << (4 * seg_size)) - 1};
+        const auto tpath_len{tpath.size()};
+
+        // depth-first, parents before their children. Threads can be very
+        // deep, so rather than recursing, keep a stack; for each container on
+        // it, the position of the next child, and the length of its
+        // thread-path.
+        struct Frame { ContainerId id; uint32_t next; size_t len; };
+        std::vector<Frame> stack{{id, container(id).children_begin, tpath_len}};
+
+        while (!stack.empty()) {
+                auto& frame{stack.back()};
+                const auto& parent{container(frame.id)};
+                if (frame.next == parent.children_end) {
+                        stack.pop_back();
+                        continue;
+                }
 
-        for (auto&& c: children) {
-                tpath.emplace_back(idx++);
-                if (c->query_match) {
-			update_container(*c, descending, tpath, seg_size,
-                                         prev_subject);
-			prev_subject = c->query_match->subject;
+                const auto idx{frame.next - parent.children_begin};
+                const auto child_id{children_[frame.next++]};
+                const auto& child{container(child_id)};
+                const auto child_level{level + stack.size() - 1};
+
+                // in the descending case, use an "inverse" sorting key, so
+                // our ascending-date sorted threads stay in that order
+                tpath.resize(frame.len);
+                ThreadPath::append(tpath, descending && child.query_match ?
+                                   max_segm - idx : idx, seg_size);
+
+                if (child.query_match) {
+			update_container(child_id, descending, tpath, child_level,
+                                         seg_size, prev_subject);
+			prev_subject = child.query_match->subject;
                 }
-                update_containers(c->children, descending, tpath, seg_size,
-				  prev_subject);
-                tpath.pop_back();
+                stack.push_back({child_id, child.children_begin, tpath.size()});
         }
-}
-
-static void
-update_containers (ContainerVec& root_vec, bool descending, size_t n)
-{
-        ThreadPath tpath;
-        tpath.reserve (n);
-
-        const auto seg_size = static_cast<size_t>(std::ceil(std::log2(n)/4.0));
-        /*note: 4 == std::log2(16)*/
 
-        size_t idx{0};
-        for (auto&& c: root_vec) {
-		tpath.emplace_back(idx++);
-		std::string prev_subject;
-		if (update_container(*c, descending, tpath, seg_size))
-			prev_subject = c->query_match->subject;
-		update_containers(c->children, descending, tpath, seg_size,
-				  prev_subject);
-                tpath.pop_back();
-        }
+        tpath.resize(tpath_len);
 }
 
-
-static void
-sort_container (Container& container)
+void
+Threader::sort_container (ContainerId id)
 {
-        // 1. childless container.
-        if (container.children.empty())
-                return; // no children;  nothing to sort.
-
-        // 2. container with children.
-        // recurse, depth-first: sort the children
-        for (auto& child: container.children)
-                sort_container(*child);
-
-        // now sort this level.
-        std::sort(container.children.begin(), container.children.end(),
-                  [&](auto&& c1, auto&& c2) {
-                          return c1->thread_date_key < c2->thread_date_key;
-                  });
+        // depth-first: sort the children before their parents. Threads can be
+        // very deep, so rather than recursing, gather the containers
+        // breadth-first (parents before their children), and handle them in
+        // reverse.
+        auto& order{walk_};
+        order.clear();
+        order.emplace_back(id);
+        for (size_t i = 0; i != order.size(); ++i) {
+                const auto& c{container(order[i])};
+                for (auto j = c.children_begin; j != c.children_end; ++j)
+                        order.emplace_back(children_[j]);
+        }
 
-        // and 'bubble up' the date of the *newest* message with a date. We
-        // reasonably assume that it's later than its parent.
-        const auto& newest_date = container.children.back()->thread_date_key;
-        if (!newest_date.empty())
-                container.thread_date_key = newest_date;
+        for (auto it = order.rbegin(); it != order.rend(); ++it) {
+                const auto begin{container(*it).children_begin};
+                const auto end{container(*it).children_end};
+
+                // 1. childless container.
+                if (begin == end)
+                        continue; // no children;  nothing to sort.
+
+                // 2. container with children; sort this level.
+                std::sort(children_.begin() + begin, children_.begin() + end,
+                          [&](auto&& id1, auto&& id2) {
+                                  return container(id1).thread_date_key <
+                                          container(id2).thread_date_key;
+                          });
+
+                // and 'bubble up' the date of the *newest* message with a date. We
+                // reasonably assume that it's later than its parent.
+                const auto newest_date{container(children_[end - 1]).thread_date_key};
+                if (newest_date != NoDate)
+                        container(*it).thread_date_key = newest_date;
+        }
 }
 
 
-static void
-sort_siblings (IdTable& id_table, bool descending)
+void
+Threader::sort_siblings (bool descending)
 {
-        if (id_table.empty())
+        if (containers_.empty())
                 return;
 
-        // unsorted vec of root containers. We can
-        // only sort these _after_ sorting the children.
-        ContainerVec root_vec;
-        for (auto&& item: id_table) {
-                if (!item.second.parent && !item.second.is_nuked)
-                        root_vec.emplace_back(&item.second);
+        // lay out the children as ranges, and gather the (unsorted) root
+        // containers. We can only sort these _after_ sorting the children.
+        children_.reserve(containers_.size());
+        for (ContainerId id = 0; id != containers_.size(); ++id) {
+                auto& c{container(id)};
+                if (c.is_nuked)
+                        continue;
+                if (c.parent == NoContainer)
+                        roots_.emplace_back(id);
+
+                c.children_begin = static_cast<uint32_t>(children_.size());
+                for (auto child_id = c.first_child; child_id != NoContainer;
+                     child_id = container(child_id).next_sibling)
+                        children_.emplace_back(child_id);
+                c.children_end = static_cast<uint32_t>(children_.size());
         }
 
         // now sort all threads _under_ the root set (by date/ascending)
-        for (auto&& c: root_vec)
-                sort_container(*c);
+        for (auto&& id: roots_)
+                sort_container(id);
 
         // and then sort the root set.
         //
@@ -523,61 +734,94 @@ sort_siblings (IdTable& id_table, bool descending)
         //
         // Note that unless we're testing, _xapian_ will handle
         // the ascending/descending of the top level.
-        std::sort(root_vec.begin(), root_vec.end(), [&](auto&& c1, auto&& c2) {
+        std::sort(roots_.begin(), roots_.end(), [&](auto&& id1, auto&& id2) {
 #ifdef BUILD_TESTS
                 if (descending)
-                        return c2->thread_date_key < c1->thread_date_key;
+                        return container(id2).thread_date_key <
+                                container(id1).thread_date_key;
                 else
 #endif /*BUILD_TESTS*/
-                        return c1->thread_date_key < c2->thread_date_key;
+                        return container(id1).thread_date_key <
+                                container(id2).thread_date_key;
         });
 
         // now all is sorted... final step is to determine thread paths and
         // other flags.
-        update_containers (root_vec, descending, id_table.size());
+        // the segment-size is the number of hex-digits for each level of
+        // the thread-path string (which we pad, so we can lexically compare
+        // them).
+        const auto seg_size = static_cast<size_t>(
+                std::ceil(std::log2(containers_.size())/4.0));
+        /*note: 4 == std::log2(16)*/
+
+        std::string tpath;
+        unsigned idx{0};
+        for (auto&& id: roots_) {
+                ThreadPath::append(tpath, idx++, seg_size);
+		std::string prev_subject;
+		if (update_container(id, descending, tpath, 0, seg_size))
+			prev_subject = container(id).query_match->subject;
+		update_containers(id, descending, tpath, 1, seg_size,
+				  prev_subject);
+                tpath.clear();
+        }
+}
+
+void
+Threader::update_query_matches()
+{
+        for (auto&& c: containers_)
+                if (c.query_match)
+                        c.query_match->thread_date = date_key_to_string(c.thread_date_key);
 }
 
-static std::ostream&
-operator<<(std::ostream& os, const IdTable& id_table)
+std::ostream&
+operator<<(std::ostream& os, const Threader& threader)
 {
         os << "------------------------------------------------\n";
-        for (auto&& item: id_table) {
-                os << item.first << " => " << item.second << "\n";
+        for (ContainerId id = 0; id != threader.containers_.size(); ++id) {
+                const auto& c{threader.container(id)};
+                const auto& span{threader.spans_[id]};
+                os << std::right << std::setw(6) << id << " "
+                   << (span.len ? threader.ids_.substr(span.offset, span.len) : "<dup>")
+                   << " => parent: " << std::setw(6) << static_cast<int64_t>(
+                           c.parent == NoContainer ? -1 : c.parent)
+                   << " [" << date_key_to_string(c.thread_date_key) << "]"
+                   << " children:";
+
+                for (auto child_id = c.first_child; child_id != NoContainer;
+                     child_id = threader.container(child_id).next_sibling)
+                        os << " " << child_id;
+
+                os << (c.is_nuked ? " nuked" : "");
+                if (c.query_match)
+                        os << "\n  " << c.query_match.value();
+                os << "\n";
         }
         os << "------------------------------------------------\n";
 
-        std::set<std::string> ids;
-        for (auto&& item: id_table) {
-                if (item.second.query_match)
-                        ids.emplace(item.second.query_match->thread_path);
-        }
-
-        for (auto&& id: ids) {
-                auto it = std::find_if(id_table.begin(), id_table.end(), [&](auto&& item) {
-                        return item.second.query_match &&
-                                item.second.query_match->thread_path == id;
-                });
-                assert(it != id_table.end());
-                os << it->first << ": " << it->second << '\n';
-        }
         return os;
 }
 
 
 template<typename Results> static void
-calculate_threads_real (Results& qres, bool descending)
+calculate_threads_real (Results& qres, bool descending,
+                        const CancelToken& cancel = {})
 {
+        Threader threader{qres.size()};
+
         // Step 1: build the id_table
-        auto id_table{determine_id_table(qres)};
+        threader.add_matches(qres, cancel);
+        cancel.check();
 
         if (g_test_verbose())
-                std::cout << "*** id-table(1):\n" << id_table << "\n";
+                std::cout << "*** id-table(1):\n" << threader << "\n";
 
         // // Step 2: get the root set
         // // Step 3: discard id_table
-        // Nope: id-table owns the containers.
+        // Nope: the threader owns the containers.
         // Step 4: prune empty containers
-        prune_empty_containers(id_table);
+        threader.prune_empty_containers();
 
         // Step 5: group root-set by subject.
         // Not implemented.
@@ -586,26 +830,24 @@ calculate_threads_real (Results& qres, bool descending)
 
         // Step 7: sort siblings. The segment-size is the number of hex-digits
         // in the thread-path string (so we can lexically compare them.)
-        sort_siblings(id_table, descending);
+        threader.sort_siblings(descending);
+        cancel.check();
 
         // Step 7a:. update querymatches
-        for (auto&& item: id_table) {
-                Container& c{item.second};
-                if (c.query_match)
-                        c.query_match->thread_date = c.thread_date_key;
-        }
-        // if (g_test_verbose())
-        //         std::cout << "*** id-table(2):\n" << id_table << "\n";
+        threader.update_query_matches();
 }
 
 void
-Mu::calculate_threads (Mu::QueryResults& qres, bool descending)
+Mu::calculate_threads (Mu::QueryResults& qres, bool descending,
+                       const CancelToken& cancel)
 {
-        calculate_threads_real(qres, descending);
+        calculate_threads_real(qres, descending, cancel);
 }
 
 #ifdef BUILD_TESTS
 
+#include <random>
+
 struct MockQueryResult {
         MockQueryResult(const std::string& message_id_arg,
                         const std::string& date_arg,
@@ -665,7 +907,7 @@ assert_thread_paths (const MockQueryResults& qrs, const Expected& expected)
                 });
                 g_assert_true (it != qrs.end());
                 g_assert_cmpstr(exp.second.c_str(), ==,
-                                it->query_match().thread_path.c_str());
+                                it->query_match().thread_path.to_string().c_str());
         }
 }
 
@@ -903,6 +1145,128 @@ test_thread_info_descending()
 
 }
 
+// A synthetic mailing-list archive (think LKML), with many interleaved
+// threads, some of them with long reply-chains.
+struct BenchQueryResult {
+        Option<std::string> message_id() const { return format("%zu@bench.example.com", idx_); }
+        Option<std::string> path()       const { return Nothing; }
+        Option<std::string> date()       const { return date_to_time_t_string(1600000000 + idx_); }
+        Option<std::string> subject()    const { return std::string{"Re: [PATCH] bench"}; }
+        QueryMatch&         query_match()      { return query_match_; }
+
+        // like most MUAs, keep the first reference and the last few.
+        std::vector<std::string> references() const {
+                constexpr size_t MaxRefs = 10;
+                std::vector<size_t> ancestors;
+                for (auto p = (*parents_)[idx_]; p != idx_; p = (*parents_)[p]) {
+                        ancestors.emplace_back(p);
+                        if ((*parents_)[p] == p)
+                                break; // thread root
+                }
+                if (ancestors.size() > MaxRefs)
+                        ancestors.erase(ancestors.begin() + MaxRefs - 1,
+                                        ancestors.end() - 1);
+
+                std::vector<std::string> refs;
+                for (auto it = ancestors.rbegin(); it != ancestors.rend(); ++it)
+                        refs.emplace_back(format("%zu@bench.example.com", *it));
+                return refs;
+        }
+
+        size_t                     idx_;
+        const std::vector<size_t>* parents_;
+        QueryMatch                 query_match_{};
+};
+
+static void
+test_perf_threads()
+{
+        constexpr size_t MsgNum       = 1000 * 1000;
+        constexpr size_t ActiveThreads = 64;
+
+        std::mt19937 rng{42};
+        std::vector<size_t> parents(MsgNum), threads(ActiveThreads);
+        std::vector<std::vector<size_t>> thread_msgs(ActiveThreads);
+
+        for (size_t idx = 0; idx != MsgNum; ++idx) {
+                auto& msgs{thread_msgs[rng() % ActiveThreads]};
+                if (msgs.empty() || rng() % 64 == 0) { // new thread
+                        msgs.clear();
+                        parents[idx] = idx;
+                } else if (rng() % 4 == 0) // reply to the last one
+                        parents[idx] = msgs.back();
+                else
+                        parents[idx] = msgs[rng() % msgs.size()];
+                msgs.emplace_back(idx);
+        }
+
+        std::vector<BenchQueryResult> results;
+        results.reserve(MsgNum);
+        for (size_t idx = 0; idx != MsgNum; ++idx)
+                results.push_back(BenchQueryResult{idx, &parents});
+
+        g_test_timer_start();
+        calculate_threads_real(results, true);
+        const auto elapsed{g_test_timer_elapsed()};
+
+        g_test_minimized_result(elapsed, "threading %zu messages: %.3fs", MsgNum, elapsed);
+
+        for (auto&& r: results)
+                g_assert_false (r.query_match().thread_path.empty());
+}
+
+// a single, very long reply-chain; threading walks it without recursing, so
+// the depth is only limited by the thread-paths, which grow with it.
+static void
+test_perf_deep_chain()
+{
+        constexpr size_t MsgNum = 16 * 1024;
+
+        std::vector<size_t> parents(MsgNum);
+        std::vector<BenchQueryResult> results;
+        results.reserve(MsgNum);
+        for (size_t idx = 0; idx != MsgNum; ++idx) {
+                parents[idx] = idx == 0 ? 0 : idx - 1;
+                results.push_back(BenchQueryResult{idx, &parents});
+        }
+
+        g_test_timer_start();
+        calculate_threads_real(results, true);
+        const auto elapsed{g_test_timer_elapsed()};
+
+        g_test_minimized_result(elapsed, "threading a %zu-deep chain: %.3fs",
+                                MsgNum, elapsed);
+
+        for (auto&& r: results)
+                g_assert_false (r.query_match().thread_path.empty());
+        g_assert_true (results.back().query_match().has_flag(
+                               QueryMatch::Flags::Last));
+}
+
+static void
+test_cancel()
+{
+        constexpr size_t MsgNum = 4096;
+
+        std::vector<size_t> parents(MsgNum);
+        std::vector<BenchQueryResult> results;
+        for (size_t idx = 0; idx != MsgNum; ++idx) {
+                parents[idx] = idx == 0 ? 0 : idx - 1;
+                results.push_back(BenchQueryResult{idx, &parents});
+        }
+
+        auto cancel{CancelToken::make()};
+        calculate_threads_real(results, false, cancel); // not cancelled (yet)
+        g_assert_false(results.back().query_match().thread_path.empty());
+
+        cancel.cancel();
+        try {
+                calculate_threads_real(results, false, cancel);
+                g_assert_not_reached();
+        } catch (const Error& err) {
+                g_assert_true(err.code() == Error::Code::Cancelled);
+        }
+}
 
 int
 main (int argc, char *argv[]) try
@@ -928,6 +1292,13 @@ main (int argc, char *argv[]) try
         g_test_add_func ("/threader/thread-info/descending",
                          test_thread_info_descending);
 
+        g_test_add_func ("/threader/cancel", test_cancel);
+
+        if (g_test_perf()) {
+                g_test_add_func ("/threader/perf/threads", test_perf_threads);
+                g_test_add_func ("/threader/perf/deep-chain", test_perf_deep_chain);
+        }
+
         return g_test_run ();
 } catch (const std::runtime_error& re) {
         std::cerr << re.what() << "\n";
@@ -21,6 +21,7 @@
 #define MU_QUERY_THREADS__
 
 #include "mu-query-results.hh"
+#include "utils/mu-cancel-token.hh"
 
 namespace Mu {
 /**
@@ -33,8 +34,11 @@ namespace Mu {
  *
  * @param qres query results
  * @param descending whether to sort the top-level in descending order
+ * @param cancel token to cancel the threading; when cancelled, throws Error
+ * (Error::Code::Cancelled)
  */
-void calculate_threads (QueryResults& qres, bool descending);
+void calculate_threads (QueryResults& qres, bool descending,
+                        const CancelToken& cancel = {});
 
 } // namespace Mu
 
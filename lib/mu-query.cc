@@ -24,6 +24,7 @@
 #include <cstring>
 #include <sstream>
 #include <cmath>
+#include <algorithm>
 
 #include <stdlib.h>
 #include <xapian.h>
@@ -48,17 +49,28 @@ struct Query::Private {
         Xapian::Enquire make_related_enquire (const StringSet& thread_ids,
                                               MuMsgFieldId sortfieldid, QueryFlags qflags) const;
 
-        Option<QueryResults> run_threaded (QueryResults&& qres, Xapian::Enquire& enq,
-                                           QueryFlags qflags) const;
+        Xapian::MSet get_mset_top_k (Xapian::Enquire& enq, QueryFlags qflags,
+                                     size_t maxnum, DeciderInfo& minfo) const;
+        Xapian::MSet get_leader_mset (Xapian::Enquire& enq, MuMsgFieldId sortfieldid,
+                                      QueryFlags qflags, size_t maxnum,
+                                      DeciderInfo& minfo) const;
+
+        Option<QueryResults> run_threaded (QueryResults&& qres, QueryFlags qflags,
+                                           const CancelToken& cancel) const;
         Option<QueryResults> run_singular (const std::string& expr, MuMsgFieldId sortfieldid,
-                                           QueryFlags qflags, size_t maxnum) const;
+                                           QueryFlags qflags, size_t maxnum,
+                                           const CancelToken& cancel) const;
         Option<QueryResults> run_related (const std::string& expr, MuMsgFieldId sortfieldid,
-                                          QueryFlags qflags, size_t maxnum) const;
+                                          QueryFlags qflags, size_t maxnum,
+                                          const CancelToken& cancel) const;
         Option<QueryResults> run (const std::string& expr, MuMsgFieldId sortfieldid,
-                                  QueryFlags qflags, size_t maxnum) const;
+                                  QueryFlags qflags, size_t maxnum,
+                                  const CancelToken& cancel) const;
 
         const Store& store_;
         const Parser parser_;
+
+        mutable ReadableCache readable_cache_;
 };
 
 Query::Query(const Store& store):
@@ -116,39 +128,126 @@ Query::Private::make_related_enquire (const StringSet& thread_ids,
 
 }
 
-struct ThreadKeyMaker: public Xapian::KeyMaker {
-        ThreadKeyMaker (const QueryMatches& matches): match_info_(matches) {}
-        std::string operator()(const Xapian::Document& doc) const override {
-                const auto it{match_info_.find(doc.get_docid())};
-                return (it == match_info_.end()) ? "" :  it->second.thread_path;
+// Get the maxnum newest (or, if not descending, oldest) matches for a query
+// sorted by date.
+//
+// Instead of letting Xapian consider (and run the decider for) _all_ matches,
+// we first restrict the query to a date-window at the newest (oldest) end of
+// the store, sized from a cheap estimate of the number of matches; if that
+// does not give us enough, we try once more with a window sized from what we
+// did find, and then fall back to the unrestricted query.
+Xapian::MSet
+Query::Private::get_mset_top_k (Xapian::Enquire& enq, QueryFlags qflags,
+                                size_t maxnum, DeciderInfo& minfo) const
+{
+        constexpr int64_t MinWindow   = 24 * 60 * 60; // one day, in seconds
+        constexpr int64_t Slack       = 2;  // aim for twice the matches we need
+        constexpr int     MaxAttempts = 2;  // windowed queries before the full one
+
+        const auto slot{static_cast<Xapian::valueno>(MU_MSG_FIELD_ID_DATE)};
+        const auto descending{any_of(qflags & QueryFlags::Descending)};
+        const auto& db{store_.database()};
+        const auto query{enq.get_query()};
+        const auto decider{make_leader_decider(qflags, minfo)};
+
+        const int64_t lower{::strtoll(db.get_value_lower_bound(slot).c_str(), {}, 10)};
+        const int64_t upper{::strtoll(db.get_value_upper_bound(slot).c_str(), {}, 10)};
+        const int64_t span{upper - lower};
+
+        // without a decider, and without asking for any documents, this is
+        // cheap.
+        const int64_t estimate{enq.get_mset(0, 0).get_matches_estimated()};
+        if (estimate <= static_cast<int64_t>(maxnum))
+                return enq.get_mset(0, maxnum, {}, decider.get()); // no use for a window
+
+        // assuming the matches are spread evenly over time, this window should
+        // have Slack * maxnum of them.
+        auto window{std::max<int64_t>(MinWindow, Slack * span * static_cast<int64_t>(maxnum) /
+                                      estimate)};
+        for (auto attempt = 0; attempt != MaxAttempts && window < span; ++attempt) {
+                const auto bound{date_to_time_t_string(descending ?
+                                                       upper - window : lower + window)};
+                enq.set_query(Xapian::Query{Xapian::Query::OP_FILTER, query,
+                                Xapian::Query{descending ? Xapian::Query::OP_VALUE_GE :
+                                              Xapian::Query::OP_VALUE_LE, slot, bound}});
+                auto mset{enq.get_mset(0, maxnum, {}, decider.get())};
+                if (mset.size() >= maxnum) {
+                        g_debug ("found %zu match(es) in %" G_GINT64_FORMAT "s window",
+                                 maxnum, window);
+                        enq.set_query(query);
+                        return mset;
+                }
+
+                // start with a clean slate for the next attempt, so we don't
+                // mistake messages from this one for duplicates.
+                minfo.matches.clear();
+                minfo.thread_ids.clear();
+                minfo.message_ids.clear();
+
+                // we got all matches in the window; size the next one from
+                // those.
+                const int64_t found(mset.size());
+                window = found == 0 ? window * Slack * static_cast<int64_t>(maxnum) :
+                        Slack * window * static_cast<int64_t>(maxnum) / found;
         }
-        const QueryMatches& match_info_;
-};
+
+        enq.set_query(query);
+        return enq.get_mset(0, maxnum, {}, decider.get());
+}
+
+Xapian::MSet
+Query::Private::get_leader_mset (Xapian::Enquire& enq, MuMsgFieldId sortfieldid,
+                                 QueryFlags qflags, size_t maxnum, DeciderInfo& minfo) const
+{
+        // "newest N"-type queries are common (e.g. for a UI showing just a
+        // screenful of headers); handle those specially.
+        if (sortfieldid == MU_MSG_FIELD_ID_DATE && maxnum < store_.size())
+                return get_mset_top_k(enq, qflags, maxnum, minfo);
+        else
+                return enq.get_mset(0, maxnum, {}, make_leader_decider(qflags, minfo).get());
+}
 
 Option<QueryResults>
-Query::Private::run_threaded (QueryResults&& qres, Xapian::Enquire& enq,
-                              QueryFlags qflags) const
+Query::Private::run_threaded (QueryResults&& qres, QueryFlags qflags,
+                              const CancelToken& cancel) const
 {
         const auto descending{any_of(qflags & QueryFlags::Descending)};
 
-        calculate_threads(qres, descending);
+        calculate_threads(qres, descending, cancel);
+
+        // We already have all the matches we need; so rather than letting
+        // Xapian sort them (in a second query), sort them here, by their
+        // thread-paths. Matches without thread-path (i.e., duplicates we
+        // could not place) are not part of the results.
+        const auto& mset{qres.mset()};
+        auto& matches{qres.query_matches()};
+
+        using PathIdx = std::pair<const ThreadPath*, Xapian::doccount>;
+        std::vector<PathIdx> path_idxs;
+        path_idxs.reserve(mset.size());
+        for (Xapian::doccount idx = 0; idx != mset.size(); ++idx) {
+                const auto it{matches.find(*mset[idx])};
+                if (it != matches.end() && !it->second.thread_path.empty())
+                        path_idxs.emplace_back(&it->second.thread_path, idx);
+        }
 
-        ThreadKeyMaker key_maker{qres.query_matches()};
-        enq.set_sort_by_key(&key_maker, descending);
+        std::sort(path_idxs.begin(), path_idxs.end(), [&](auto&& p1, auto&& p2) {
+                return descending ? *p2.first < *p1.first : *p1.first < *p2.first;
+        });
 
-        DeciderInfo minfo;
-        minfo.matches = qres.query_matches();
-        auto mset{enq.get_mset(0, store_.size(), {},
-                               make_thread_decider(qflags, minfo).get())};
-        mset.fetch();
+        MSetOrder order;
+        order.reserve(path_idxs.size());
+        for (auto&& path_idx: path_idxs)
+                order.emplace_back(path_idx.second);
 
-        return QueryResults{mset, std::move(qres.query_matches())};
+        return QueryResults{mset, std::move(matches), std::move(order)};
 }
 
 
 Option<QueryResults>
 Query::Private::run_singular (const std::string& expr, MuMsgFieldId sortfieldid,
-                              QueryFlags qflags, size_t maxnum) const
+                              QueryFlags qflags, size_t maxnum,
+                              const CancelToken& cancel) const
 {
         // i.e. a query _without_ related messages, but still possibly
         // with threading.
@@ -160,17 +259,20 @@ Query::Private::run_singular (const std::string& expr, MuMsgFieldId sortfieldid,
         const auto threading{any_of(qflags & QueryFlags::Threading)};
 
         DeciderInfo minfo{};
+        minfo.readable_cache = &readable_cache_;
+        minfo.cancel         = cancel;
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored   "-Wextra"
-        auto enq{make_enquire(expr, threading ? MU_MSG_FIELD_ID_DATE : sortfieldid, qflags)};
+        const auto eff_sortfieldid{threading ? MU_MSG_FIELD_ID_DATE : sortfieldid};
         #pragma GCC diagnostic ignored "-Wswitch-default"
 #pragma GCC diagnostic pop
-        auto mset{enq.get_mset(0, maxnum, {}, make_leader_decider(singular_qflags, minfo).get())};
+        auto enq{make_enquire(expr, eff_sortfieldid, qflags)};
+        auto mset{get_leader_mset(enq, eff_sortfieldid, singular_qflags, maxnum, minfo)};
         mset.fetch();
 
         auto qres{QueryResults{mset, std::move(minfo.matches)}};
 
-        return threading ? run_threaded(std::move(qres), enq, qflags) : qres;
+        return threading ? run_threaded(std::move(qres), qflags, cancel) : qres;
 }
 
 static Option<std::string>
@@ -181,7 +283,8 @@ opt_string(const Xapian::Document& doc, MuMsgFieldId id) noexcept try {
 
 Option<QueryResults>
 Query::Private::run_related (const std::string& expr, MuMsgFieldId sortfieldid,
-                             QueryFlags qflags, size_t maxnum) const
+                             QueryFlags qflags, size_t maxnum,
+                             const CancelToken& cancel) const
 {
         // i.e. a query _with_ related messages and possibly with threading.
         //
@@ -195,13 +298,16 @@ Query::Private::run_related (const std::string& expr, MuMsgFieldId sortfieldid,
 
         // Run our first, "leader" query
         DeciderInfo minfo{};
+        minfo.readable_cache = &readable_cache_;
+        minfo.cancel         = cancel;
         auto enq{make_enquire(expr, MU_MSG_FIELD_ID_DATE, leader_qflags)};
-        const auto mset{enq.get_mset(0, maxnum, {},
-                                     make_leader_decider(leader_qflags, minfo).get())};
+        const auto mset{get_leader_mset(enq, MU_MSG_FIELD_ID_DATE, leader_qflags,
+                                        maxnum, minfo)};
 
         // Gather the thread-ids we found
         mset.fetch();
         for (auto it = mset.begin(); it != mset.end(); ++it) {
+                cancel.check();
                 auto thread_id{opt_string(it.get_document(), MU_MSG_FIELD_ID_THREAD_ID)};
                 if (thread_id)
                         minfo.thread_ids.emplace(std::move(*thread_id));
@@ -214,16 +320,19 @@ Query::Private::run_related (const std::string& expr, MuMsgFieldId sortfieldid,
         // is unlimited and the sorting happens during threading.
         auto r_enq{make_related_enquire(minfo.thread_ids,
                                         threading ? MU_MSG_FIELD_ID_NONE : sortfieldid, qflags)};
-        const auto r_mset{r_enq.get_mset(0, threading ? store_.size() : maxnum,
-                                         {}, make_related_decider(qflags, minfo).get())};
+        auto r_mset{r_enq.get_mset(0, threading ? store_.size() : maxnum,
+                                   {}, make_related_decider(qflags, minfo).get())};
+        if (threading)
+                r_mset.fetch();
+
         auto qres{QueryResults{r_mset, std::move(minfo.matches)}};
-        return threading ? run_threaded(std::move(qres), r_enq, qflags) : qres;
+        return threading ? run_threaded(std::move(qres), qflags, cancel) : qres;
 }
 
 
 Option<QueryResults>
 Query::Private::run (const std::string& expr, MuMsgFieldId sortfieldid,
-                     QueryFlags qflags, size_t maxnum) const
+                     QueryFlags qflags, size_t maxnum, const CancelToken& cancel) const
 {
         const auto eff_maxnum{maxnum == 0 ? store_.size() : maxnum};
 #pragma GCC diagnostic push
@@ -231,16 +340,19 @@ Query::Private::run (const std::string& expr, MuMsgFieldId sortfieldid,
         const auto eff_sortfield{sortfieldid == MU_MSG_FIELD_ID_NONE ?
                 MU_MSG_FIELD_ID_DATE : sortfieldid };
 #pragma GCC diagnostic pop
+        if (any_of(qflags & QueryFlags::SkipUnreadable))
+                readable_cache_.begin_query();
+
         if (any_of(qflags & QueryFlags::IncludeRelated))
-                return run_related (expr, eff_sortfield, qflags, eff_maxnum);
+                return run_related (expr, eff_sortfield, qflags, eff_maxnum, cancel);
         else
-                return run_singular(expr, eff_sortfield, qflags, eff_maxnum);
+                return run_singular(expr, eff_sortfield, qflags, eff_maxnum, cancel);
 }
 
 
 Option<QueryResults>
 Query::run (const std::string& expr, MuMsgFieldId sortfieldid,
-           QueryFlags qflags, size_t maxnum) const try
+           QueryFlags qflags, size_t maxnum, const CancelToken& cancel) const try
 {
         // some flags are for internal use only.
         g_return_val_if_fail (none_of(qflags & QueryFlags::Leader), Nothing);
@@ -251,13 +363,24 @@ Query::run (const std::string& expr, MuMsgFieldId sortfieldid,
                             any_of(qflags & QueryFlags::Threading) ? "yes" : "no",
                             maxnum)};
 
-        return priv_->run(expr, sortfieldid, qflags, maxnum);
+        return priv_->run(expr, sortfieldid, qflags, maxnum, cancel);
 
+} catch (const Error& err) {
+        if (err.code() == Error::Code::Cancelled)
+                g_debug ("query '%s' was cancelled", expr.c_str());
+        return Nothing;
 } catch (...) {
         return Nothing;
 }
 
 
+void
+Query::set_readable_max_age (Duration max_age)
+{
+        priv_->readable_cache_.set_max_age(max_age);
+}
+
+
 size_t
 Query::count (const std::string& expr) const try
 {
@@ -26,6 +26,7 @@
 #include <mu-store.hh>
 #include <mu-query-results.hh>
 #include <utils/mu-utils.hh>
+#include <utils/mu-cancel-token.hh>
 
 namespace Mu
 {
@@ -59,12 +60,15 @@ class Query
          * @param sortfieldid the sortfield-id. If the field is NONE, sort by DATE
          * @param flags query flags
          * @param maxnum maximum number of results to return. 0 for 'no limit'
+         * @param cancel token to cancel the query (from another thread)
          *
-         * @return the query-results, or Nothing in case of error.
+         * @return the query-results, or Nothing in case of error or when the
+         * query was cancelled.
          */
         Option<QueryResults> run (const std::string &expr        = "",
                                   MuMsgFieldId       sortfieldid = MU_MSG_FIELD_ID_NONE,
-                                  QueryFlags flags = QueryFlags::None, size_t maxnum = 0) const;
+                                  QueryFlags flags = QueryFlags::None, size_t maxnum = 0,
+                                  const CancelToken& cancel = {}) const;
 
         /**
          * run a Xapian query to count the number of matches; for the syntax, please
@@ -76,6 +80,17 @@ class Query
          */
         size_t count (const std::string &expr = "") const;
 
+        /**
+         * With QueryFlags::SkipUnreadable, we check whether message files are
+         * readable. By default, we check each of them; this allows for
+         * answering from directory listings instead, re-using those for some
+         * time.
+         *
+         * @param max_age maximum age of the directory listings; 0 to check
+         * each file
+         */
+        void set_readable_max_age (Duration max_age);
+
         /**
          * For debugging, get the internal string representation of the parsed
          * query
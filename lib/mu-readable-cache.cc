@@ -0,0 +1,264 @@
+/*
+** Copyright (C) 2021 Dirk-Jan C. Binnema <djcb@djcbsoftware.nl>
+**
+** This program is free software; you can redistribute it and/or modify it
+** under the terms of the GNU General Public License as published by the
+** Free Software Foundation; either version 3, or (at your option) any
+** later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software Foundation,
+** Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+**
+*/
+
+#include "mu-readable-cache.hh"
+
+#include <mutex>
+#include <unordered_map>
+
+#include <dirent.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include <glib.h>
+
+using namespace Mu;
+
+struct DirInfo {
+        enum struct Readable { Unknown, Yes, No };
+
+        bool                                      readable{}; /**< can we read the dir? */
+        std::unordered_map<std::string, Readable> files;      /**< the files in the dir */
+        Clock::time_point                         read_at;    /**< start of the query that read it */
+};
+
+struct ReadableCache::Private {
+        Private (Duration max_age): max_age_{max_age} {}
+
+        // listings are fresh for max_age after the start of the query that
+        // read them.
+        bool is_fresh (const DirInfo& dinfo) const {
+                return query_start_ - dinfo.read_at < max_age_;
+        }
+
+        DirInfo& dir_info (const std::string& dir);
+
+        Duration          max_age_;
+        Clock::time_point query_start_{Clock::now()};
+
+        std::unordered_map<std::string, DirInfo> dirs_;
+        mutable std::mutex                       lock_;
+};
+
+static DirInfo
+read_dir (const std::string& dir)
+{
+        DirInfo dinfo;
+
+        // we need to list the directory (r) and be able to reach the files
+        // in it (x)
+        if (::access(dir.c_str(), R_OK | X_OK) != 0)
+                return dinfo;
+
+        auto dirp{::opendir(dir.c_str())};
+        if (!dirp) {
+                g_debug ("failed to open %s: %s", dir.c_str(), g_strerror(errno));
+                return dinfo;
+        }
+
+        // only the names; whether a listed file is readable (it may not be,
+        // e.g. with mode 000) we check when someone asks for it.
+        dinfo.readable = true;
+        while (auto dentry = ::readdir(dirp)) {
+                if (::strcmp(dentry->d_name, ".") == 0 ||
+                    ::strcmp(dentry->d_name, "..") == 0)
+                        continue;
+                dinfo.files.emplace(dentry->d_name, DirInfo::Readable::Unknown);
+        }
+        ::closedir(dirp);
+
+        return dinfo;
+}
+
+DirInfo&
+ReadableCache::Private::dir_info (const std::string& dir)
+{
+        auto it = dirs_.find(dir);
+        if (it != dirs_.end() && is_fresh(it->second))
+                return it->second;
+
+        auto dinfo{read_dir(dir)};
+        dinfo.read_at = query_start_;
+
+        return dirs_[dir] = std::move(dinfo);
+}
+
+ReadableCache::ReadableCache (Duration max_age):
+        priv_{std::make_unique<Private>(max_age)}
+{}
+
+ReadableCache::~ReadableCache() = default;
+
+void
+ReadableCache::begin_query(Clock::time_point now)
+{
+        std::lock_guard<std::mutex> l_{priv_->lock_};
+        priv_->query_start_ = now;
+
+        // drop the stale listings; so we only keep those of the last
+        // max_age (or none at all).
+        for (auto it = priv_->dirs_.begin(); it != priv_->dirs_.end();) {
+                if (priv_->is_fresh(it->second))
+                        ++it;
+                else
+                        it = priv_->dirs_.erase(it);
+        }
+}
+
+bool
+ReadableCache::is_readable (const std::string& path)
+{
+        const auto slash{path.find_last_of('/')};
+        if (slash == std::string::npos || slash == 0 || slash + 1 == path.size())
+                return ::access(path.c_str(), R_OK) == 0; // nothing to cache.
+
+        std::lock_guard<std::mutex> l_{priv_->lock_};
+        if (priv_->max_age_ == Duration::zero())
+                return ::access(path.c_str(), R_OK) == 0; // no caching.
+
+        auto& dinfo{priv_->dir_info(path.substr(0, slash))};
+        if (!dinfo.readable)
+                return false;
+
+        const auto it{dinfo.files.find(path.substr(slash + 1))};
+        if (it == dinfo.files.end())
+                return false; // not listed; no need to ask.
+
+        if (it->second == DirInfo::Readable::Unknown)
+                it->second = ::access(path.c_str(), R_OK) == 0 ?
+                        DirInfo::Readable::Yes : DirInfo::Readable::No;
+
+        return it->second == DirInfo::Readable::Yes;
+}
+
+void
+ReadableCache::invalidate (const std::string& dir)
+{
+        std::lock_guard<std::mutex> l_{priv_->lock_};
+        priv_->dirs_.erase(dir);
+}
+
+void
+ReadableCache::clear()
+{
+        std::lock_guard<std::mutex> l_{priv_->lock_};
+        priv_->dirs_.clear();
+}
+
+void
+ReadableCache::set_max_age (Duration max_age)
+{
+        std::lock_guard<std::mutex> l_{priv_->lock_};
+        priv_->max_age_ = max_age;
+}
+
+size_t
+ReadableCache::size() const
+{
+        std::lock_guard<std::mutex> l_{priv_->lock_};
+        return priv_->dirs_.size();
+}
+
+
+#ifdef BUILD_TESTS
+/*
+ * Tests.
+ *
+ */
+
+#include <fstream>
+#include <sys/stat.h>
+#include "test-mu-common.hh"
+
+static void
+touch (const std::string& path)
+{
+        std::ofstream{path} << "hello\n";
+}
+
+static void
+test_readable_basic()
+{
+        char *tmpdir{test_mu_common_get_random_tmpdir()};
+        g_assert_cmpint(g_mkdir_with_parents(tmpdir, 0700), ==, 0);
+
+        const std::string dir{tmpdir};
+        g_free(tmpdir);
+
+        touch (dir + "/msg1");
+        touch (dir + "/msg2");
+
+        const auto t0{Clock::now()};
+
+        // by default, there's no caching.
+        ReadableCache nocache;
+        nocache.begin_query(t0);
+        g_assert_true (nocache.is_readable(dir + "/msg1"));
+        g_assert_false (nocache.is_readable(dir + "/msg3"));
+        g_assert_cmpuint (nocache.size(), ==, 0);
+
+        ReadableCache cache{std::chrono::hours(1)};
+        cache.begin_query(t0);
+        g_assert_true (cache.is_readable(dir + "/msg1"));
+        g_assert_false (cache.is_readable(dir + "/msg3"));
+        g_assert_false (cache.is_readable(dir + "/nosuchdir/msg1"));
+        g_assert_cmpuint (cache.size(), ==, 2);
+
+        // while the listing is fresh, we do not see changes; that holds for
+        // the files we asked about...
+        ::unlink ((dir + "/msg1").c_str());
+        cache.begin_query(t0 + std::chrono::minutes(30));
+        g_assert_true (cache.is_readable(dir + "/msg1"));
+
+        // ... while for the others, we only know they were listed.
+        ::unlink ((dir + "/msg2").c_str());
+        g_assert_false (cache.is_readable(dir + "/msg2"));
+
+        // after max_age, we drop the stale listings.
+        cache.begin_query(t0 + std::chrono::minutes(90));
+        g_assert_cmpuint (cache.size(), ==, 0);
+        g_assert_false (cache.is_readable(dir + "/msg1"));
+        g_assert_cmpuint (cache.size(), ==, 1);
+
+        touch (dir + "/msg3");
+        cache.invalidate(dir);
+        g_assert_true (cache.is_readable(dir + "/msg3"));
+
+        // listed, but not readable
+        ::chmod ((dir + "/msg3").c_str(), 0);
+        cache.invalidate(dir);
+        g_assert_cmpint (::access((dir + "/msg3").c_str(), R_OK) == 0, ==,
+                         cache.is_readable(dir + "/msg3")); // root can read anyway
+
+        cache.clear();
+        g_assert_cmpuint (cache.size(), ==, 0);
+}
+
+
+int
+main (int argc, char *argv[])
+{
+        g_test_init (&argc, &argv, NULL);
+
+        g_test_add_func ("/readable-cache/basic", test_readable_basic);
+
+        return g_test_run ();
+}
+#endif /*BUILD_TESTS*/
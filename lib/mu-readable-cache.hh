@@ -0,0 +1,108 @@
+/*
+** Copyright (C) 2021 Dirk-Jan C. Binnema <djcb@djcbsoftware.nl>
+**
+** This program is free software; you can redistribute it and/or modify it
+** under the terms of the GNU General Public License as published by the
+** Free Software Foundation; either version 3, or (at your option) any
+** later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software Foundation,
+** Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+**
+*/
+
+#ifndef MU_READABLE_CACHE_HH__
+#define MU_READABLE_CACHE_HH__
+
+#include <string>
+#include <memory>
+
+#include <utils/mu-utils.hh>
+
+namespace Mu {
+
+/// Cache for answering "is this message file readable?" from memory.
+///
+/// Instead of calling access(2) for every message, we list each directory once,
+/// and remember the names in it; a file that is not listed is not readable. For
+/// the files that are, we check (and remember) their readability the first
+/// time someone asks. On network file-systems (NFS, sshfs, ...) this saves
+/// the lookups for the missing files, and, as the listings are re-used across
+/// queries, the repeated ones for the others.
+///
+/// Directory listings stay valid for max_age after the start of the query (see
+/// begin_query()) that read them; stale ones are dropped at the start of each
+/// query. A max_age of 0 (the default) disables the cache; then we simply
+/// check each file.
+class ReadableCache {
+public:
+        /**
+         * Construct a ReadableCache
+         *
+         * @param max_age how long a directory listing stays valid; 0
+         * disables the cache
+         */
+        ReadableCache (Duration max_age = {});
+
+        /**
+         * DTOR
+         */
+        ~ReadableCache();
+
+        /**
+         * Mark the start of a new query; directory listings read more than
+         * max_age before this are considered stale, and dropped.
+         *
+         * @param now the start time of the query
+         */
+        void begin_query(Clock::time_point now = Clock::now());
+
+        /**
+         * Is the file at path readable?
+         *
+         * @param path an absolute path to a file
+         *
+         * @return true or false
+         */
+        bool is_readable (const std::string& path);
+
+        /**
+         * Forget about some directory, e.g. after its contents changed.
+         *
+         * @param dir path to a directory
+         */
+        void invalidate (const std::string& dir);
+
+        /**
+         * Forget about all directories.
+         */
+        void clear();
+
+        /**
+         * Set the maximum age of directory listings across queries.
+         *
+         * @param max_age the new maximum age
+         */
+        void set_max_age (Duration max_age);
+
+        /**
+         * Get the number of cached directories.
+         *
+         * @return number of directories
+         */
+        size_t size() const;
+
+private:
+        struct                   Private;
+        std::unique_ptr<Private> priv_;
+};
+
+} // namespace Mu
+
+#endif /* MU_READABLE_CACHE_HH__ */
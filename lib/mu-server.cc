@@ -24,12 +24,18 @@
 #include "mu-server.hh"
 
 #include <iostream>
+#include <sstream>
 #include <string>
 #include <algorithm>
 #include <atomic>
+#include <unordered_set>
+#include <unordered_map>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
 #include <functional>
+#include <chrono>
+#include <cmath>
 
 #include <cstring>
 #include <glib.h>
@@ -42,23 +48,68 @@
 #include "mu-store.hh"
 #include "mu-msg-part.hh"
 #include "mu-contacts.hh"
+#include "mu-header-sexp.hh"
 
 #include "utils/mu-str.h"
 #include "utils/mu-utils.hh"
 #include "utils/mu-command-parser.hh"
+#include "utils/mu-sexp-writer.hh"
 #include "utils/mu-readline.hh"
+#include "utils/mu-async-queue.hh"
+#include "utils/mu-cancel-token.hh"
+#include "utils/mu-option.hh"
 
 using namespace Mu;
 using namespace Command;
 
+/// A lane of the executor: a thread that runs the jobs for some category of
+/// commands, one after the other. When destroyed, it finishes the jobs that
+/// are still queued.
+class Lane {
+public:
+        using Job = std::function<void()>;
+
+        Lane(): thread_{[this]{ run(); }} {}
+        ~Lane() {
+                running_ = false;
+                thread_.join();
+        }
+
+        void push(Job&& job) { queue_.push(std::move(job)); }
+
+private:
+        void run() {
+                while (running_ || !queue_.empty()) {
+                        Job job;
+                        if (queue_.pop(job, std::chrono::milliseconds(100)))
+                                job();
+                }
+        }
+
+        AsyncQueue<Job>   queue_;
+        std::atomic<bool> running_{true};
+        std::thread       thread_; // last, so the above are ready when it starts.
+};
+
+/// The command the current thread is executing.
+struct CurrentCommand {
+        Option<int> request_id;  /**< Request-id the client passed, if any */
+        CancelToken cancel;      /**< Token for cancelling the command */
+};
+static thread_local CurrentCommand Current;
+
 /// @brief object to manage the server-context for all commands.
 struct Server::Private {
-        Private(Store& store, Output output):
+        Private(Store& store, Output output, SexpWriter::Format format,
+                Duration readable_max_age):
                 store_{store},
                 output_{output},
+                format_{format},
                 command_map_{make_command_map()},
                 query_{store_},
-                keep_going_{true} {}
+                keep_going_{true} {
+                query_.set_readable_max_age(readable_max_age);
+        }
         //
         // construction helpers
         //
@@ -77,24 +128,39 @@ struct Server::Private {
         //
         bool invoke (const std::string& expr) noexcept;
 
+        //
+        // executor
+        //
+        void dispatch (Sexp&& call, Option<int> request_id);
+        void run_command (const Sexp& call) noexcept;
+        void wait_idle ();
+        bool cancelled () const { return Current.cancel.cancelled(); }
+
         //
         // output
         //
-        void output_sexp(Sexp&& sexp) const {
+        void output (const std::string& str, OutputFlags flags) const {
+                std::lock_guard<std::mutex> lock{output_lock_};
                 if (output_)
-                        output_(std::move(sexp));
+                        output_(str, flags);
         }
-        void output_sexp(Sexp::List&& lst) const {
-                output_sexp(Sexp::make_list(std::move(lst)));
+        void output_sexp(Sexp&& sexp, OutputFlags flags = OutputFlags::None) const;
+        void output_sexp(Sexp::List&& lst, OutputFlags flags = OutputFlags::None) const {
+                output_sexp(Sexp::make_list(std::move(lst)), flags);
         }
-        size_t output_sexp (const QueryResults& qres);
+
+        using DocIdSet = std::unordered_set<Store::Id>;
+        size_t output_sexp (const QueryResults& qres, size_t batch_size = 0,
+                            DocIdSet* sent = {});
 
         //
         // handlers for various commands.
         //
         void add_handler (const Parameters& params);
+        void cancel_handler (const Parameters& params);
         void compose_handler (const Parameters& params);
         void contacts_handler (const Parameters& params);
+        void complete_handler (const Parameters& params);
         void extract_handler (const Parameters& params);
         void find_handler (const Parameters& params);
         void help_handler (const Parameters& params);
@@ -124,10 +190,24 @@ private:
 
         Store&           store_;
         Server::Output   output_;
+        const SexpWriter::Format format_;
+        mutable std::mutex output_lock_;
         const CommandMap command_map_;
-        const Query      query_;
+        Query            query_;
 
         std::atomic<bool> keep_going_{};
+
+        std::mutex              exec_lock_;
+        std::condition_variable exec_cv_;
+        size_t                  queued_{}, done_{};           // all commands
+        size_t                  main_queued_{}, main_done_{}; // main lane only
+        CancelToken             last_find_;               // the most recent find
+        std::vector<CancelToken> indexing_;               // running / queued index commands
+        std::unordered_map<int, CancelToken> pending_;    // request-id -> token
+
+        // the lanes must come last, so they are stopped before anything else
+        // goes away.
+        Lane                    main_lane_, find_lane_, index_lane_;
 };
 
 static void
@@ -137,7 +217,7 @@ add_thread_info (Sexp::List& items, const QueryMatch& qmatch)
 
         auto symbol_t = []{return Sexp::make_symbol("t");};
 
-        info.add_prop(":path",  Sexp::make_string(qmatch.thread_path));
+        info.add_prop(":path",  Sexp::make_string(qmatch.thread_path.to_string()));
         info.add_prop(":level", Sexp::make_number(qmatch.thread_level));
         info.add_prop(":date",  Sexp::make_string(qmatch.thread_date));
 
@@ -189,8 +269,10 @@ Server::Private::make_command_map ()
 
       cmap.emplace("add",
                    CommandInfo{
-                           ArgMap{ {":path", ArgInfo{Type::String, true, "file system path to the message" }}},
-                           "add a message to the store",
+                           ArgMap{ {":path",  ArgInfo{Type::String, false, "file system path to the message" }},
+                                   {":paths", ArgInfo{Type::List, false,
+                                            "file system paths to the messages, to add many at once" }}},
+                           "add message(s) to the store",
                            [&](const auto& params){add_handler(params);}});
 
       cmap.emplace("compose",
@@ -204,6 +286,17 @@ Server::Private::make_command_map ()
                            "compose a new message",
                            [&](const auto& params){compose_handler(params);}});
 
+      cmap.emplace("complete",
+                   CommandInfo{
+                           ArgMap{ {":prefix",   ArgInfo{Type::String, true,
+                                                   "prefix of a name or address" }},
+                                   {":maxnum",   ArgInfo{Type::Number, false,
+                                            "maximum number of contacts (default: 10)" }},
+                                   {":personal", ArgInfo{Type::Symbol, false,
+                                                   "only personal contacts" }}},
+                           "get the best contacts matching some prefix",
+                           [&](const auto& params){complete_handler(params);}});
+
       cmap.emplace("contacts",
                    CommandInfo{
                            ArgMap{ {":personal", ArgInfo{Type::Symbol, false,
@@ -211,7 +304,7 @@ Server::Private::make_command_map ()
                                    {":after",    ArgInfo{Type::String, false,
                                             "only contacts seen after time_t string" }},
                                    {":tstamp",   ArgInfo{Type::String, false,
-                                            "return changes since tstamp" }}},
+                                            "return changes since tstamp (as returned earlier)" }}},
                            "get contact information",
                            [&](const auto& params){contacts_handler(params);}});
 
@@ -243,8 +336,12 @@ Server::Private::make_command_map ()
                                             "maximum number of result (hint)" }},
                                    {":skip-dups",  ArgInfo{Type::Symbol, false,
                                             "whether to skip messages with duplicate message-ids" }},
+                                   {":skip-unreadable",  ArgInfo{Type::Symbol, false,
+                                            "whether to skip messages whose file is not readable" }},
                                    {":include-related",  ArgInfo{Type::Symbol, false,
-                                            "whether to include other message related to matching ones" }}},
+                                            "whether to include other message related to matching ones" }},
+                                   {":batch-size",  ArgInfo{Type::Number, false,
+                                            "if > 0, stream the results in batches of this size" }}},
                            "query the database for messages",
                            [&](const auto& params){find_handler(params);}});
 
@@ -262,7 +359,9 @@ Server::Private::make_command_map ()
                                    {":cleanup",      ArgInfo{Type::Symbol, false,
                                                            "whether to remove stale messages from the store"}},
                                    {":lazy-check",   ArgInfo{Type::Symbol, false,
-                                            "whether to avoid indexing up-to-date directories"}}},
+                                            "whether to avoid indexing up-to-date directories"}},
+                                   {":progress-interval", ArgInfo{Type::Number, false,
+                                            "milliseconds between progress updates (0: none)"}}},
                            "scan maildir for new/updated/removed messages",
                            [&](const auto& params){index_handler(params);}});
 
@@ -294,6 +393,11 @@ Server::Private::make_command_map ()
                            "ping the mu-server and get information in response",
                           [&](const auto& params){ping_handler(params);}});
 
+      cmap.emplace("cancel",
+                   CommandInfo{{},
+                           "cancel the command with the given :request-id",
+                           [&](const auto& params){cancel_handler(params);}});
+
       cmap.emplace("quit",
                    CommandInfo{{},
                            "quit the mu server",
@@ -352,18 +456,151 @@ make_error (Error::Code errcode, const char* frm, ...)
         return Sexp::make_list(std::move(err));
 }
 
-bool
-Server::Private::invoke (const std::string& expr) noexcept
+void
+Server::Private::output_sexp (Sexp&& sexp, OutputFlags flags) const
 {
-        if (!keep_going_)
-                return false;
+        thread_local std::string buf; // re-used for all output
+        buf.clear();
+
+        SexpWriter writer{buf, format_};
+        if (Current.request_id && sexp.is_prop_list()) { // echo the request-id
+                writer.begin_prop_list()
+                        .prop(":request-id").number(*Current.request_id);
+                const auto& lst{sexp.list()};
+                for (auto it = lst.begin(); it != lst.end(); it += 2)
+                        writer.prop(it->value().c_str()).sexp(*(it + 1));
+                writer.end_prop_list();
+        } else
+                writer.sexp(sexp);
+
+        output(buf, flags);
+}
+
+// remove the :request-id (if any) from the call, and return it.
+static Option<int>
+take_request_id (Sexp& call)
+{
+        if (!call.is_call())
+                return Nothing;
+
+        Option<int> request_id;
+        Sexp::List args;
+        const auto& lst{call.list()};
+        for (size_t i = 0; i != lst.size(); ++i) {
+                if (i % 2 == 1 && i + 1 != lst.size() &&
+                    lst.at(i).is_symbol() && lst.at(i).value() == ":request-id") {
+                        if (!lst.at(i + 1).is_number())
+                                throw Error(Error::Code::InvalidArgument,
+                                            "request-id must be a number");
+                        request_id = ::atoi(lst.at(++i).value().c_str());
+                } else
+                        args.add(Sexp{lst.at(i)});
+        }
+
+        if (request_id)
+                call = Sexp::make_list(std::move(args));
+
+        return request_id;
+}
+
+/*
+ * Commands run asynchronously, so a long-running command does not hold up
+ * the others; in particular, 'index' and 'find' get lanes of their own, while
+ * the remaining commands run in order in the main lane.
+ *
+ * A 'find' first waits for the main-lane commands that came before it (such as
+ * a 'move'), so it sees their changes; and when a newer 'find' comes in, it is
+ * cancelled, since the client only wants the latest results anyway. That
+ * cancels the query itself as well, not just its output.
+ *
+ * Commands with a :request-id can also be cancelled explicitly, with
+ * (cancel :request-id <id>).
+ */
+void
+Server::Private::dispatch (Sexp&& call, Option<int> request_id)
+{
+        const std::string cmd{call.is_call() ? call.list().at(0).value() : ""};
+        const auto is_find{cmd == "find"}, is_main{!is_find && cmd != "index"};
+
+        std::lock_guard<std::mutex> lock{exec_lock_};
+
+        const auto main_seq{main_queued_};
+        const auto cancel{CancelToken::make()};
+        if (is_find) {
+                last_find_.cancel();
+                last_find_ = cancel;
+        } else if (!is_main)
+                indexing_.emplace_back(cancel);
+        if (request_id)
+                pending_[*request_id] = cancel;
+        ++queued_;
+        if (is_main)
+                ++main_queued_;
+
+        Lane::Job job = [=, call = std::move(call)] {
+                if (is_find) { // wait for the main-lane commands before us.
+                        std::unique_lock<std::mutex> lock{exec_lock_};
+                        exec_cv_.wait(lock, [&]{ return main_done_ >= main_seq; });
+                }
+
+                Current.request_id = request_id;
+                Current.cancel     = cancel;
+                if (cancelled())
+                        ; // nothing to do
+                else if (is_main) {
+                        // the main-lane commands are short; they simply hold
+                        // the store lock, while find takes care of its own.
+                        // Note that find holds it while running the query
+                        // (and threading), and yields it only between
+                        // batches of headers; so we may wait for that.
+                        std::lock_guard<StoreLock> slock{store().lock()};
+                        run_command(call);
+                } else
+                        run_command(call);
+
+                if (cancelled() && request_id) {
+                        Sexp::List lst;
+                        lst.add_prop(":cancelled", Sexp::make_symbol("t"));
+                        output_sexp(std::move(lst), OutputFlags::Flush);
+                }
+                Current = {};
+
+                {
+                        std::lock_guard<std::mutex> lock{exec_lock_};
+                        if (request_id) {
+                                auto it{pending_.find(*request_id)};
+                                if (it != pending_.end() && it->second == cancel)
+                                        pending_.erase(it);
+                        }
+                        if (!is_find && !is_main)
+                                indexing_.erase(std::find(indexing_.begin(),
+                                                          indexing_.end(), cancel));
+                        ++done_;
+                        if (is_main)
+                                ++main_done_;
+                }
+                exec_cv_.notify_all();
+        };
+
+        if (is_find)
+                find_lane_.push(std::move(job));
+        else if (is_main)
+                main_lane_.push(std::move(job));
+        else
+                index_lane_.push(std::move(job));
+}
 
+void
+Server::Private::run_command (const Sexp& call) noexcept
+{
         try {
-                auto call{Sexp::Sexp::make_parse(expr)};
                 Command::invoke(command_map(), call);
 
         } catch (const Mu::Error& me) {
                 output_sexp(make_error(me.code(), "%s", me.what()));
+        } catch (const Xapian::Error& xerr) {
+                output_sexp(make_error(Error::Code::Store, "%s",
+                                       xerr.get_msg().c_str()));
         } catch (const std::runtime_error& re) {
                 output_sexp(make_error(Error::Code::Internal, "caught exception: %s", re.what()));
                 keep_going_ = false;
@@ -372,6 +609,49 @@ Server::Private::invoke (const std::string& expr) noexcept
                 keep_going_ = false;
         }
 
+        output({}, OutputFlags::Flush); // the command is done, so flush.
+}
+
+void
+Server::Private::wait_idle ()
+{
+        std::unique_lock<std::mutex> lock{exec_lock_};
+        exec_cv_.wait(lock, [this]{ return done_ == queued_; });
+}
+
+bool
+Server::Private::invoke (const std::string& expr) noexcept
+{
+        if (!keep_going_)
+                return false;
+
+        try {
+                auto call{Sexp::Sexp::make_parse(expr)};
+                auto request_id{take_request_id(call)};
+
+                const std::string cmd{call.is_call() ? call.list().at(0).value() : ""};
+                if (cmd == "quit" || cmd == "cancel") {
+                        if (cmd == "quit") {
+                                // finish what we were doing first; except for
+                                // indexing, which may take a long time.
+                                {
+                                        std::lock_guard<std::mutex> lock{exec_lock_};
+                                        for (auto&& token: indexing_)
+                                                token.cancel();
+                                }
+                                wait_idle();
+                        }
+                        Current.request_id = request_id;
+                        Command::invoke(command_map(), call);
+                        Current = {};
+                } else
+                        dispatch(std::move(call), std::move(request_id));
+
+        } catch (const Mu::Error& me) {
+                output_sexp(make_error(me.code(), "%s", me.what()));
+                output({}, OutputFlags::Flush);
+        }
+
         return keep_going_;
 }
 
@@ -394,34 +674,71 @@ message_options (const Parameters& params)
         return (MuMsgOptions)opts;
 }
 
-/* 'add' adds a message to the database, and takes two parameters: 'path', which
- * is the full path to the message, and 'maildir', which is the maildir this
- * message lives in (e.g. "/inbox"). response with an (:info ...) message with
- * information about the newly added message (details: see code below)
+/* 'add' adds a message to the database, and takes one parameter: 'path', which
+ * is the full path to the message; or 'paths', a list of such paths, which adds
+ * them all in one go. responds with an (:info ...) message with information
+ * about each newly added message (details: see code below), followed by its
+ * (:update ...).
  */
 void
 Server::Private::add_handler (const Parameters& params)
 {
-        auto path{get_string_or(params, ":path")};
-        const auto docid{store().add_message(path)};
+        auto paths{get_string_vec(params, ":paths")};
+        const auto path{get_string_or(params, ":path")};
+        if (!path.empty())
+                paths.emplace_back(path);
+        if (paths.empty())
+                throw Error(Error::Code::InvalidArgument, "expected :path or :paths");
+
+        size_t failed{};
+        std::string first_error;
+        for (auto&& res: store().add_messages(paths)) {
+
+                if (res.id == Store::InvalidId) {
+                        if (failed++ == 0)
+                                first_error = res.path + ": " + res.error;
+                        continue;
+                }
 
-        Sexp::List expr;
-        expr.add_prop(":info",  Sexp::make_symbol("add"));
-        expr.add_prop(":path",  Sexp::make_string(path));
-        expr.add_prop(":docid", Sexp::make_number(docid));
+                Sexp::List expr;
+                expr.add_prop(":info",  Sexp::make_symbol("add"));
+                expr.add_prop(":path",  Sexp::make_string(res.path));
+                expr.add_prop(":docid", Sexp::make_number(res.id));
 
-        output_sexp(Sexp::make_list(std::move(expr)));
+                output_sexp(Sexp::make_list(std::move(expr)));
 
-        auto msg{store().find_message(docid)};
-        if (!msg)
-                throw Error(Error::Code::Store,
-                            "failed to get message at %s (docid=%u)",
-                            path.c_str(), docid);
+                auto msg{store().find_message(res.id)};
+                if (!msg)
+                        throw Error(Error::Code::Store,
+                                    "failed to get message at %s (docid=%u)",
+                                    res.path.c_str(), res.id);
 
-        Sexp::List update;
-        update.add_prop(":update", build_message_sexp(msg, docid, {}, MU_MSG_OPTION_VERIFY));
-        output_sexp(Sexp::make_list(std::move(update)));
-        mu_msg_unref(msg);
+                Sexp::List update;
+                update.add_prop(":update", build_message_sexp(msg, res.id, {}, MU_MSG_OPTION_VERIFY));
+                output_sexp(Sexp::make_list(std::move(update)));
+                mu_msg_unref(msg);
+        }
+
+        if (failed == 1)
+                throw Error(Error::Code::Store, "failed to add %s", first_error.c_str());
+        else if (failed > 1)
+                throw Error(Error::Code::Store, "failed to add %zu message(s), e.g. %s",
+                            failed, first_error.c_str());
+}
+
+/* cancel the command with the request-id (which invoke() took from the call
+ * already); if it's no longer pending, there is nothing to do. The cancelled
+ * command reports (:cancelled t) when it's done. */
+void
+Server::Private::cancel_handler (const Parameters& params)
+{
+        if (!Current.request_id)
+                throw Error(Error::Code::InvalidArgument, "missing :request-id");
+
+        std::lock_guard<std::mutex> lock{exec_lock_};
+        const auto it{pending_.find(*Current.request_id)};
+        if (it != pending_.end())
+                it->second.cancel();
 }
 
 
@@ -510,17 +827,22 @@ Server::Private::contacts_handler (const Parameters& params)
 
         const auto after{afterstr.empty() ? 0 :
                         g_ascii_strtoll(date_to_time_t_string(afterstr, true).c_str(), {}, 10)};
-        const auto tstamp = g_ascii_strtoll (tstampstr.c_str(), NULL, 10);
+        /* the 'tstamp' is "<generation>:<seq>", where seq is the sequence
+         * number of the last change we sent, and generation identifies the
+         * store (its creation time); so when the store was re-created, we
+         * send everything. We take a plain "<seq>" as well. */
+        const auto generation{static_cast<guint64>(store().metadata().created)};
+        const auto sepa{tstampstr.find(':')};
+        auto since{g_ascii_strtoull (tstampstr.c_str() +
+                                     (sepa == std::string::npos ? 0 : sepa + 1),
+                                     NULL, 10)};
+        if (sepa != std::string::npos &&
+            g_ascii_strtoull (tstampstr.c_str(), NULL, 10) != generation)
+                since = 0;
 
-        auto rank{0};
         Sexp::List contacts;
-        store().contacts().for_each([&](const ContactInfo& ci) {
-
-                rank++;
-
-                /* since the last time we got some contacts */
-                if (tstamp > ci.tstamp)
-                        return;
+        const auto last_seq = store().contacts().for_each_since(
+                since, [&](const ContactInfo& ci, size_t rank) {
                 /* (maybe) only include 'personal' contacts */
                 if (personal && !ci.personal)
                         return;
@@ -530,19 +852,46 @@ Server::Private::contacts_handler (const Parameters& params)
 
                 Sexp::List contact;
                 contact.add_prop(":address", Sexp::make_string(ci.full_address));
-                contact.add_prop(":rank",    Sexp::make_number(rank));
+                contact.add_prop(":rank",    Sexp::make_number(static_cast<int>(rank)));
 
                 contacts.add(Sexp::make_list(std::move(contact)));
         });
 
         Sexp::List seq;
         seq.add_prop(":contacts", Sexp::make_list(std::move(contacts)));
-        seq.add_prop(":tstamp",   Sexp::make_string(format("%" G_GINT64_FORMAT,
-                                                           g_get_monotonic_time())));
+        seq.add_prop(":tstamp",   Sexp::make_string(format("%" G_GUINT64_FORMAT ":%" G_GUINT64_FORMAT,
+                                                           generation,
+                                                           static_cast<guint64>(last_seq))));
         /* dump the contacts cache as a giant sexp */
         output_sexp(std::move(seq));
 }
 
+void
+Server::Private::complete_handler (const Parameters& params)
+{
+        const auto prefix   = get_string_or(params, ":prefix");
+        const auto maxnum   = get_int_or(params,    ":maxnum", 10);
+        const auto personal = get_bool_or(params,   ":personal");
+
+        Sexp::List contacts;
+        size_t rank{};
+        store().contacts().complete(
+                prefix, std::max(maxnum, 0),
+                [&](const ContactInfo& ci) {
+                        Sexp::List contact;
+                        contact.add_prop(":address", Sexp::make_string(ci.full_address));
+                        contact.add_prop(":rank",    Sexp::make_number(static_cast<int>(rank++)));
+                        contacts.add(Sexp::make_list(std::move(contact)));
+                },
+                [&](const ContactInfo& ci) { return !personal || ci.personal; });
+
+        Sexp::List seq;
+        seq.add_prop(":complete", Sexp::make_string(prefix));
+        seq.add_prop(":contacts", Sexp::make_list(std::move(contacts)));
+
+        output_sexp(std::move(seq));
+}
+
 
 static Sexp::List
 save_part (MuMsg *msg, unsigned docid, unsigned index,
@@ -733,19 +1082,65 @@ determine_docids (const Query& q, const Parameters& params)
 }
 
 
+/**
+ * Output the headers for the query results
+ *
+ * @param qres query results
+ * @param batch_size if > 0, flush the output after each batch of this many
+ * headers
+ * @param sent if non-null, skip the messages in this set, and add the ones we
+ * output; the caller must hold the store lock (once), which we yield between
+ * batches.
+ *
+ * @return the number of results
+ */
 size_t
-Server::Private::output_sexp (const QueryResults& qres)
+Server::Private::output_sexp (const QueryResults& qres, size_t batch_size,
+                              DocIdSet* sent)
 {
-        size_t n{};
+        /* without a batch-size, still yield the lock every so often */
+        constexpr size_t YieldBatchSize = 256;
+
+        thread_local std::string buf;
+        size_t n{}, batched{};
         for (auto&& mi: qres) {
-                ++n;
-                auto msg{mi.floating_msg()};
-                if (!msg)
+                if (cancelled())
+                        break; // e.g., a newer find came in.
+
+                const auto docid{mi.doc_id()};
+                if (sent && sent->count(docid) > 0)
+                        continue; // already sent.
+
+                // we render the headers straight from the document; this is
+                // much faster than going through MuMsg.
+                buf.clear();
+                try {
+                        SexpWriter writer{buf, format_};
+                        writer.begin_prop_list();
+                        if (Current.request_id)
+                                writer.prop(":request-id").number(*Current.request_id);
+                        write_header_props(writer, mi.document(), docid,
+                                           &mi.query_match());
+                        writer.end_prop_list();
+                } catch (const Xapian::DocNotFoundError&) {
+                        // removed while we yielded the lock; simply skip it.
+                        g_debug ("message %u disappeared; skipping", docid);
                         continue;
+                }
+
+                if (sent)
+                        sent->emplace(docid);
+                ++n;
 
-                auto qm{mi.query_match()};
-                output_sexp(build_message_sexp(msg, mi.doc_id(),
-                                               qm, MU_MSG_OPTION_HEADERS_ONLY));
+                const auto flush{batch_size > 0 && ++batched % batch_size == 0};
+                output(buf, flush ? OutputFlags::Flush : OutputFlags::None);
+
+                // only between batches, let other commands (e.g. 'view') and
+                // the indexer use the store, if they're waiting. We do not hold
+                // any document here; any that disappear meanwhile are skipped
+                // (above).
+                if (flush || (batch_size == 0 && n % YieldBatchSize == 0))
+                        store().lock().yield();
         }
 
         return n;
@@ -761,7 +1156,9 @@ Server::Private::find_handler (const Parameters& params)
         const auto descending{get_bool_or(params,      ":descending", false)};
         const auto maxnum{get_int_or(params,           ":maxnum", -1/*unlimited*/)};
         const auto skip_dups{get_bool_or(params,       ":skip-dups", false)};
+        const auto skip_unreadable{get_bool_or(params, ":skip-unreadable", false)};
         const auto include_related{get_bool_or(params, ":include-related", false)};
+        const auto batch_size{get_int_or(params,       ":batch-size", 0)};
 
         MuMsgFieldId sort_field{MU_MSG_FIELD_ID_NONE};
         if (!sortfieldstr.empty()) {
@@ -772,18 +1169,36 @@ Server::Private::find_handler (const Parameters& params)
                                         sortfieldstr.c_str()};
         }
 
+        /* we hold the store lock while we're using the database (results),
+         * including while running the query; output_sexp yields it between
+         * batches of headers */
+        std::lock_guard<StoreLock> slock{store().lock()};
+
         auto qflags{QueryFlags::None};
         if (descending)
                 qflags |= QueryFlags::Descending;
         if (skip_dups)
                 qflags |= QueryFlags::SkipDuplicates;
+        if (skip_unreadable)
+                qflags |= QueryFlags::SkipUnreadable;
         if (include_related)
                 qflags |= QueryFlags::IncludeRelated;
         if (threads)
                 qflags |= QueryFlags::Threading;
 
-        auto qres{query().run(q, sort_field, qflags, maxnum)};
-        if (!qres)
+        /* when streaming without threads / related messages, the first
+         * results are the same as those of a query for only a single batch,
+         * which is much cheaper; so we send those before running the full
+         * query. With threads, we need all results before we know which come
+         * first, so we can only send them in batches. */
+        const auto stream_first{batch_size > 0 && !threads && !include_related &&
+                (maxnum < 0 || batch_size < maxnum)};
+
+        auto qres{query().run(q, sort_field, qflags,
+                              stream_first ? batch_size : maxnum, Current.cancel)};
+        if (!qres && cancelled())
+                return;
+        else if (!qres)
                 throw Error(Error::Code::Query, "failed to run query");
 
         /* before sending new results, send an 'erase' message, so the frontend
@@ -795,11 +1210,31 @@ Server::Private::find_handler (const Parameters& params)
                 output_sexp(std::move(lst));
         }
 
+        size_t foundnum{};
+        if (!stream_first)
+                foundnum = output_sexp(*qres, std::max(batch_size, 0));
+        else {
+                DocIdSet sent;
+                foundnum = output_sexp(*qres, batch_size, &sent);
+                /* if the first batch was not full, that's all there is */
+                if (foundnum == static_cast<size_t>(batch_size)) {
+                        auto all_qres{query().run(q, sort_field, qflags, maxnum,
+                                                  Current.cancel)};
+                        if (!all_qres && cancelled())
+                                return;
+                        else if (!all_qres)
+                                throw Error(Error::Code::Query, "failed to run query");
+                        foundnum += output_sexp(*all_qres, batch_size, &sent);
+                }
+        }
+
+        if (cancelled())
+                return; // no need to report on the cancelled find.
+
         {
-                const auto foundnum{output_sexp (*qres)};
                 Sexp::List lst;
                 lst.add_prop(":found", Sexp::make_number(foundnum));
-                output_sexp(std::move(lst));
+                output_sexp(std::move(lst), OutputFlags::Flush);
         }
 }
 
@@ -809,12 +1244,13 @@ Server::Private::help_handler (const Parameters& params)
         const auto command{get_symbol_or(params, ":command", "")};
         const auto full{get_bool_or(params, ":full", !command.empty())};
 
+        std::stringstream ss;
         if (command.empty()) {
-                std::cout << ";; Commands are s-expressions of the form\n"
-                          << ";;   (<command-name> :param1 val1 :param2 val2 ...)\n"
-                          << ";; For instance:\n;;  (help :command quit)\n"
-                          << ";; to get detailed information about the 'quit'\n;;\n";
-                std::cout << ";; The following commands are available:\n\n";
+                ss << ";; Commands are s-expressions of the form\n"
+                   << ";;   (<command-name> :param1 val1 :param2 val2 ...)\n"
+                   << ";; For instance:\n;;  (help :command quit)\n"
+                   << ";; to get detailed information about the 'quit'\n;;\n";
+                ss << ";; The following commands are available:\n\n";
         }
 
         std::vector<std::string> names;
@@ -829,52 +1265,99 @@ Server::Private::help_handler (const Parameters& params)
                         continue;
 
                 if (!command.empty())
-                        std::cout << ";;   " << format("%-10s -- %s\n", name.c_str(),
-                                                       info.docstring.c_str());
+                        ss << ";;   " << format("%-10s -- %s\n", name.c_str(),
+                                                info.docstring.c_str());
                 else
-                        std::cout << ";;  " << name.c_str() << " -- "
-                                  << info.docstring.c_str() << '\n';
+                        ss << ";;  " << name.c_str() << " -- "
+                           << info.docstring.c_str() << '\n';
                 if (!full)
                         continue;
 
                 for (auto&& argname: info.sorted_argnames()) {
                         const auto& arg{info.args.find(argname)};
-                        std::cout << ";;        "
-                                  << format("%-17s  : %-24s ", arg->first.c_str(),
-                                            to_string(arg->second).c_str());
-                        std::cout << "  " << arg->second.docstring << "\n";
+                        ss << ";;        "
+                           << format("%-17s  : %-24s ", arg->first.c_str(),
+                                     to_string(arg->second).c_str());
+                        ss << "  " << arg->second.docstring << "\n";
                 }
-                std::cout << ";;\n";
+                ss << ";;\n";
         }
+
+        // in JSON mode, everything we write must be a JSON object (on a line
+        // of its own); so send the help as a response.
+        if (format_ == SexpWriter::Format::Json) {
+                Sexp::List lst;
+                lst.add_prop(":help", Sexp::make_string(ss.str()));
+                output_sexp(std::move(lst));
+                return;
+        }
+
+        // otherwise, it's for humans; write it as-is, but not in the middle of
+        // some other output.
+        std::lock_guard<std::mutex> lock{output_lock_};
+        std::cout << ss.str() << std::flush;
 }
 
 static Sexp::List
-get_stats (const Indexer::Progress& stats, const std::string& state)
+get_stats (const Indexer::Progress& stats, const std::string& state,
+           std::chrono::steady_clock::duration elapsed = {})
 {
         Sexp::List lst;
 
         lst.add_prop(":info",       Sexp::make_symbol("index"));
         lst.add_prop(":status",     Sexp::make_symbol(std::string{state}));
+        lst.add_prop(":discovered", Sexp::make_number(stats.discovered));
         lst.add_prop(":processed",  Sexp::make_number(stats.processed));
         lst.add_prop(":updated",    Sexp::make_number(stats.updated));
         lst.add_prop(":cleaned-up", Sexp::make_number(stats.removed));
 
+        // estimate the remaining time (in seconds) from the rate so far; note
+        // that while scanning, the scanner may still discover more messages.
+        if (stats.running && stats.processed > 0 &&
+            stats.discovered >= stats.processed) {
+                const auto secs{std::chrono::duration<double>(elapsed).count()};
+                const auto eta{(stats.discovered - stats.processed) * secs / stats.processed};
+                lst.add_prop(":eta", Sexp::make_number(static_cast<int>(std::lround(eta))));
+        }
+
         return lst;
 }
 
+/* 'index' runs in a lane of its own, so the other commands can run while it
+ * is busy; it sends (unsolicited) progress updates every :progress-interval
+ * milliseconds. */
 void
 Server::Private::index_handler (const Parameters& params)
 {
+        using Clock = std::chrono::steady_clock;
+
         Mu::Indexer::Config conf{};
         conf.cleanup    = get_bool_or(params, ":cleanup");
         conf.lazy_check = get_bool_or(params, ":lazy-check");
 
+        const auto interval{std::chrono::milliseconds(
+                        std::max(get_int_or(params, ":progress-interval", 1000), 0))};
+
         indexer().stop();
 
+        const auto started{Clock::now()};
+        auto next_update{started + interval};
+
         indexer().start(conf);
         while (indexer().is_running()) {
-                std::this_thread::sleep_for(std::chrono::milliseconds(1000));
-                output_sexp(get_stats(indexer().progress(), "running"));
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                if (cancelled()) {
+                        indexer().stop();
+                        return;
+                }
+
+                const auto now{Clock::now()};
+                if (interval.count() == 0 || now < next_update)
+                        continue;
+
+                next_update = now + interval;
+                output_sexp(get_stats(indexer().progress(), "running", now - started),
+                            OutputFlags::Flush);
         }
         output_sexp(get_stats(indexer().progress(), "complete"));
 }
@@ -1118,9 +1601,11 @@ void
 Server::Private::sent_handler (const Parameters& params)
 {
         const auto path{get_string_or(params, ":path")};
-        const auto docid{store().add_message(path)};
-        if (docid == Store::InvalidId)
-                throw Error{Error::Code::Store, "failed to add path"};
+        const auto res{store().add_messages({path}).at(0)};
+        if (res.id == Store::InvalidId)
+                throw Error{Error::Code::Store, "failed to add %s: %s",
+                                path.c_str(), res.error.c_str()};
+        const auto docid{res.id};
 
         Sexp::List lst;
         lst.add_prop (":sent",  Sexp::make_symbol("t"));
@@ -1225,8 +1710,9 @@ Server::Private::view_handler (const Parameters& params)
         output_sexp (std::move(seq));
 }
 
-Server::Server(Store& store, Server::Output output):
-        priv_{std::make_unique<Private>(store, output)}
+Server::Server(Store& store, Server::Output output, SexpWriter::Format format,
+               Duration readable_max_age):
+        priv_{std::make_unique<Private>(store, output, format, readable_max_age)}
 {}
 
 Server::~Server() = default;
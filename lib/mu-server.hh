@@ -25,6 +25,8 @@
 #include <functional>
 
 #include <utils/mu-sexp.hh>
+#include <utils/mu-sexp-writer.hh>
+#include <utils/mu-utils.hh>
 #include <mu-store.hh>
 
 namespace Mu {
@@ -35,15 +37,30 @@ namespace Mu {
  */
 class Server {
 public:
-        using Output = std::function<void(Sexp&& sexp)>;
+        enum struct OutputFlags {
+                None  = 0,      /**< No flags */
+                Flush = 1 << 0, /**< Flush output, so the client sees it immediately */
+        };
+
+        /// Output handler, which receives the s-expression (or JSON) strings
+        /// for the server's responses. The commands run in their own threads,
+        /// but the calls to the handler are serialized. After each command,
+        /// it is called with an empty string and OutputFlags::Flush.
+        using Output = std::function<void(const std::string& sexp_str, OutputFlags flags)>;
 
         /**
          * Construct a new server
          *
          * @param store a message store object
          * @param output callable for the server responses.
+         * @param format format for the responses; either s-expressions or
+         * their JSON equivalent. The commands are s-expressions in either case.
+         * @param readable_max_age for find with :skip-unreadable, how long to
+         * re-use directory listings; 0 to check each message file.
          */
-        Server(Store& store, Output output);
+        Server(Store& store, Output output,
+               SexpWriter::Format format = SexpWriter::Format::Sexp,
+               Duration readable_max_age = {});
 
         /**
          * DTOR
@@ -51,7 +68,11 @@ public:
         ~Server();
 
         /**
-         * Invoke a call on the server.
+         * Invoke a call on the server. The call can have a :request-id
+         * <number> parameter, which is then echoed in the responses.
+         *
+         * The command runs asynchronously ('quit' excepted); the server
+         * finishes any outstanding commands when it is destroyed.
          *
          * @param expr the s-expression to call
          *
@@ -64,6 +85,8 @@ private:
         struct                   Private;
         std::unique_ptr<Private> priv_;
 };
+MU_ENABLE_BITOPS(Server::OutputFlags);
+
 } // namespace Mu
 
 #endif /* MU_SERVER_HH__ */
@@ -27,9 +27,12 @@
 #include <stdexcept>
 #include <unordered_map>
 #include <atomic>
+#include <thread>
+#include <algorithm>
 #include <type_traits>
 #include <iostream>
 #include <cstring>
+#include <sstream>
 
 #include <xapian.h>
 
@@ -48,7 +51,8 @@ static_assert(std::is_same<Store::Id, Xapian::docid>::value,
 
 constexpr auto SchemaVersionKey     = "schema-version";
 constexpr auto RootMaildirKey       = "maildir"; // XXX: make this 'root-maildir'
-constexpr auto ContactsKey          = "contacts";
+constexpr auto ContactsKey          = "contacts"; // older versions: all contacts
+constexpr auto ContactKeyPrefix     = "contact:";  // one entry per contact
 constexpr auto PersonalAddressesKey = "personal-addresses";
 constexpr auto CreatedKey           = "created";
 constexpr auto BatchSizeKey         = "batch-size";
@@ -59,20 +63,22 @@ constexpr auto DefaultMaxMessageSize = 100'000'000U;
 
 constexpr auto ExpectedSchemaVersion = MU_STORE_SCHEMA_VERSION;
 
+constexpr auto MaxMetadataKeySize    = 240U; // a little less than Xapian's limit
+
 /* we cache these prefix strings, so we don't have to allocate them all
- * the time; this should save 10-20 string allocs per message */
+ * the time; this should save 10-20 string allocs per message. The table
+ * is a function-local static, so its initialization is thread-safe; this
+ * matters as add_messages() builds documents from several threads. */
 G_GNUC_CONST static const std::string&
 prefix (MuMsgFieldId mfid)
 {
-        static std::string fields[MU_MSG_FIELD_ID_NUM];
-        static bool initialized = false;
-
-        if (G_UNLIKELY(!initialized)) {
+        static const auto fields = []{
+                std::array<std::string, MU_MSG_FIELD_ID_NUM> arr;
                 for (int i = 0; i != MU_MSG_FIELD_ID_NUM; ++i)
-                        fields[i] = std::string (1, mu_msg_field_xapian_prefix
-                                                 ((MuMsgFieldId)i));
-                initialized = true;
-        }
+                        arr[i] = std::string (1, mu_msg_field_xapian_prefix
+                                              ((MuMsgFieldId)i));
+                return arr;
+        }();
 
         return fields[mfid];
 }
@@ -104,7 +110,7 @@ add_synonym_for_prio (MuMsgPrio prio, Xapian::WritableDatabase *db)
 
 struct Store::Private {
 
-#define LOCKED std::lock_guard<std::mutex> l(lock_);
+#define LOCKED std::lock_guard<StoreLock> l(lock_);
 
         enum struct XapianOpts {ReadOnly, Open, CreateOverwrite, InMemory };
 
@@ -112,7 +118,7 @@ struct Store::Private {
                 read_only_{readonly},
                 db_{make_xapian_db(path, read_only_ ? XapianOpts::ReadOnly : XapianOpts::Open)},
                 mdata_{make_metadata(path)},
-                contacts_{db().get_metadata(ContactsKey), mdata_.personal_addresses} {
+                contacts_{"", mdata_.personal_addresses} {
 
                 if (!readonly)
                         writable_db().begin_transaction();
@@ -123,7 +129,8 @@ struct Store::Private {
                 read_only_{false},
                 db_{make_xapian_db(path, XapianOpts::CreateOverwrite)},
                 mdata_{init_metadata(conf, path, root_maildir, personal_addresses)},
-                contacts_{"", mdata_.personal_addresses} {
+                contacts_{"", mdata_.personal_addresses},
+                contacts_loaded_{true} {
 
                 writable_db().begin_transaction();
         }
@@ -133,15 +140,14 @@ struct Store::Private {
                 read_only_{false},
                 db_{make_xapian_db("", XapianOpts::InMemory)},
                 mdata_{init_metadata(conf, "", root_maildir, personal_addresses)},
-                contacts_{"", mdata_.personal_addresses} {
+                contacts_{"", mdata_.personal_addresses},
+                contacts_loaded_{true} {
         }
 
         ~Private() try {
                 g_debug("closing store @ %s", mdata_.database_path.c_str());
-                if (!read_only_) {
-                        writable_db().set_metadata (ContactsKey, contacts_.serialize());
+                if (!read_only_)
                         commit();
-                }
         } MU_XAPIAN_CATCH_BLOCK;
 
         std::unique_ptr<Xapian::Database> make_xapian_db (const std::string db_path, XapianOpts opts) try {
@@ -176,8 +182,9 @@ struct Store::Private {
                 return dynamic_cast<Xapian::WritableDatabase&>(*db_.get());
         }
 
-        void dirty () try {
-                if (++dirtiness_ > mdata_.batch_size)
+        void dirty (size_t n=1) try {
+                dirtiness_ += n;
+                if (dirtiness_ > mdata_.batch_size)
                         commit();
         } MU_XAPIAN_CATCH_BLOCK;
 
@@ -186,10 +193,74 @@ struct Store::Private {
                 dirtiness_      = 0;
                 if (mdata_.in_memory)
                         return; // not supported in the in-memory backend.
+                if (contacts_loaded_)
+                        save_contacts();
                 writable_db().commit_transaction();
                 writable_db().begin_transaction();
         } MU_XAPIAN_CATCH_BLOCK;
 
+        // Contacts are stored as separate metadata entries, so we only need to
+        // write the ones that changed; and we only load them when they are
+        // needed, which many commands never do.
+        Contacts& contacts() {
+                if (!contacts_loaded_) {
+                        LOCKED;
+                        if (!contacts_loaded_) {
+                                load_contacts();
+                                contacts_loaded_ = true;
+                        }
+                }
+                return contacts_;
+        }
+
+        // the metadata key for some contact; we only use it to find the
+        // entry (the value has the full contact), so for (very rare) addresses
+        // too long for a key, we use their start and a hash of the rest.
+        static std::string contact_key (const std::string& email) {
+                char *down{g_ascii_strdown(email.c_str(), -1)};
+                std::string key{ContactKeyPrefix};
+                key += down;
+                g_free(down);
+
+                if (key.size() > MaxMetadataKeySize) {
+                        auto sum{g_compute_checksum_for_string(G_CHECKSUM_SHA256,
+                                                               key.c_str(), -1)};
+                        const std::string suffix{std::string{"#"} + sum};
+                        g_free(sum);
+                        key.resize(MaxMetadataKeySize - suffix.size());
+                        key += suffix;
+                }
+
+                return key;
+        }
+
+        void load_contacts () {
+                const auto blob{db().get_metadata(ContactsKey)};
+                contacts_.load([&](auto&& each_serialized) {
+                        std::stringstream ss{blob, std::ios_base::in};
+                        std::string line;
+                        while (getline (ss, line))
+                                each_serialized(line);
+                        // these are newer than the blob, if any
+                        for (auto it = db().metadata_keys_begin(ContactKeyPrefix);
+                             it != db().metadata_keys_end(ContactKeyPrefix); ++it)
+                                each_serialized(db().get_metadata(*it));
+                });
+
+                if (!blob.empty() && !read_only_) { // convert to the new format
+                        save_contacts(true/*all*/);
+                        writable_db().set_metadata(ContactsKey, "");
+                }
+        }
+
+        void save_contacts (bool all=false) {
+                const auto n = contacts_.save([this](auto&& email, auto&& serialized) {
+                        // note: an empty value removes the entry
+                        writable_db().set_metadata(contact_key(email), serialized);
+                }, all);
+                g_debug ("saved %zu contact(s)", n);
+        }
+
         void add_synonyms () {
                 mu_flags_foreach ((MuFlagsForeachFunc)add_synonym_for_flag,
                                   &writable_db());
@@ -250,16 +321,18 @@ struct Store::Private {
 
         Xapian::docid add_or_update_msg (Xapian::docid docid, MuMsg *msg, GError **err);
         Xapian::Document new_doc_from_message (MuMsg *msg);
+        Xapian::Document make_document (MuMsg *msg, const std::string& uid_term);
 
         const bool               read_only_{};
         std::unique_ptr<Xapian::Database> db_;
 
         const Store::Metadata    mdata_;
         Contacts                 contacts_;
+        std::atomic<bool>        contacts_loaded_{};
         std::unique_ptr<Indexer> indexer_;
 
         std::atomic<bool>                 in_transaction_{};
-        std::mutex                        lock_;
+        StoreLock                         lock_;
         size_t                            dirtiness_{};
 
         mutable std::atomic<std::size_t> ref_count_{1};
@@ -284,7 +357,7 @@ get_uid_term (const char* path)
 }
 
 #undef  LOCKED
-#define LOCKED  std::lock_guard<std::mutex> l__(priv_->lock_)
+#define LOCKED  std::lock_guard<StoreLock> l__(priv_->lock_)
 
 Store::Store (const std::string& path, bool readonly):
         priv_{std::make_unique<Private>(path, readonly)}
@@ -320,7 +393,7 @@ Store::metadata() const
 const Contacts&
 Store::contacts() const
 {
-        return priv_->contacts_;
+        return priv_->contacts();
 }
 
 
@@ -336,6 +409,58 @@ Store::writable_database()
         return priv_->writable_db();
 }
 
+StoreLock&
+Store::lock() const
+{
+        return priv_->lock_;
+}
+
+void
+StoreLock::lock()
+{
+        if (mtx_.try_lock())
+                return; // uncontended, or we already hold it.
+
+        {
+                std::lock_guard<std::mutex> l{waiters_mtx_};
+                ++waiting_;
+        }
+        mtx_.lock();
+        {
+                std::lock_guard<std::mutex> l{waiters_mtx_};
+                --waiting_;
+                ++acquired_;
+        }
+        waiters_cv_.notify_all();
+}
+
+void
+StoreLock::unlock()
+{
+        mtx_.unlock();
+}
+
+void
+StoreLock::yield()
+{
+        size_t target{};
+        {
+                std::lock_guard<std::mutex> l{waiters_mtx_};
+                if (waiting_ == 0)
+                        return; // nobody to yield to.
+                target = acquired_ + waiting_;
+        }
+
+        // wait for the threads that were waiting to have had their turn; new
+        // ones will have to wait for us.
+        mtx_.unlock();
+        {
+                std::unique_lock<std::mutex> l{waiters_mtx_};
+                waiters_cv_.wait(l, [&]{ return acquired_ >= target; });
+        }
+        lock();
+}
+
 Indexer&
 Store::indexer()
 {
@@ -414,6 +539,95 @@ Store::add_message (const std::string& path)
         return docid;
 }
 
+// the number of messages add_messages() parses before adding them to the
+// database, so we don't need to keep all of them in memory at the same time.
+constexpr size_t AddMessagesChunkSize = 1024;
+
+Store::AddResults
+Store::add_messages (const StringVec& paths)
+{
+        priv_->writable_db(); // throws if we're read-only.
+        // make sure the contacts are loaded, so the parsing threads won't
+        // need the store lock for that.
+        priv_->contacts();
+
+        const auto& root_maildir{metadata().root_maildir};
+        auto parse = [&](const std::string& path, std::string& uid_term) {
+                GError *gerr{};
+                const auto maildir{maildir_from_path(root_maildir, path)};
+                auto msg{mu_msg_new_from_file (path.c_str(), maildir.c_str(), &gerr)};
+                if (G_UNLIKELY(!msg)) {
+                        const std::string what{gerr ? gerr->message : "something went wrong"};
+                        g_clear_error(&gerr);
+                        throw Error{Error::Code::Message, "failed to create message: %s",
+                                        what.c_str()};
+                }
+                try {
+                        uid_term = get_uid_term(path.c_str());
+                        auto doc{priv_->make_document(msg, uid_term)};
+                        mu_msg_unref (msg);
+                        return doc;
+                } catch (...) {
+                        mu_msg_unref (msg);
+                        throw;
+                }
+        };
+
+        AddResults results(paths.size());
+        std::vector<Xapian::Document> docs(std::min(paths.size(), AddMessagesChunkSize));
+        std::vector<std::string> uid_terms(docs.size());
+        const size_t max_threads{std::max(std::thread::hardware_concurrency(), 1U)};
+        size_t added{};
+
+        for (size_t chunk = 0; chunk < paths.size(); chunk += AddMessagesChunkSize) {
+
+                const auto n{std::min(paths.size() - chunk, AddMessagesChunkSize)};
+                std::atomic<size_t> next{0};
+                auto worker = [&] {
+                        for (auto i = next++; i < n; i = next++) {
+                                auto& res{results[chunk + i]};
+                                res.path = paths[chunk + i];
+                                try {
+                                        docs[i] = parse(res.path, uid_terms[i]);
+                                } catch (const Mu::Error& er) {
+                                        res.error = er.what();
+                                } catch (const Xapian::Error& xerr) {
+                                        res.error = xerr.get_msg();
+                                } catch (...) {
+                                        res.error = "something went wrong";
+                                }
+                        }
+                };
+
+                std::vector<std::thread> threads;
+                for (size_t t = 1; t < std::min(max_threads, n); ++t)
+                        threads.emplace_back(worker);
+                worker();
+                for (auto&& thread: threads)
+                        thread.join();
+
+                LOCKED;
+                for (size_t i = 0; i != n; ++i) {
+                        auto& res{results[chunk + i]};
+                        if (!res.error.empty())
+                                continue;
+                        try {
+                                res.id = priv_->writable_db().replace_document(uid_terms[i], docs[i]);
+                                ++added;
+                        } catch (const Xapian::Error& xerr) {
+                                res.error = "failed to add message: " + xerr.get_msg();
+                        }
+                        docs[i] = {};
+                }
+        }
+
+        g_debug ("added %zu of %zu message(s)", added, paths.size());
+        LOCKED;
+        priv_->dirty(added); // we commit (at most) once, for the whole batch.
+
+        return results;
+}
+
 bool
 Store::update_message (MuMsg *msg, unsigned docid)
 {
@@ -464,6 +678,29 @@ Store::remove_messages (const std::vector<Store::Id>& ids)
         } MU_XAPIAN_CATCH_BLOCK;
 }
 
+size_t
+Store::remove_messages (const StringVec& paths)
+{
+        LOCKED;
+
+        size_t n{};
+        try {
+                for (auto&& path: paths) {
+                        const auto term{get_uid_term(path.c_str())};
+                        if (!priv_->db().term_exists(term))
+                                continue;
+                        priv_->writable_db().delete_document(term);
+                        ++n;
+                }
+
+        } MU_XAPIAN_CATCH_BLOCK;
+
+        g_debug ("removed %zu of %zu message(s) from store", n, paths.size());
+        priv_->dirty(n);
+
+        return n;
+}
+
 time_t
 Store::dirstamp (const std::string& path) const
 {
@@ -526,23 +763,42 @@ Store::contains_message (const std::string& path) const
 std::size_t
 Store::for_each_message_path (Store::ForEachMessageFunc func) const
 {
-        LOCKED;
-
-        size_t n{};
-
-        try {
-                Xapian::Enquire enq{priv_->db()};
+        // this can take a while (e.g., the indexer's cleanup does a syscall
+        // per message); so only hold the lock while getting a chunk of paths.
+        constexpr size_t ChunkSize = 4096;
 
-                enq.set_query  (Xapian::Query::MatchAll);
-                enq.set_cutoff (0,0);
+        using IdPath = std::pair<Store::Id, std::string>;
+        std::vector<IdPath> chunk;
+        chunk.reserve(ChunkSize);
 
-                Xapian::MSet matches(enq.get_mset (0, priv_->db().get_doccount()));
+        size_t n{};
+        Store::Id next{1};
+        while (true) {
+                chunk.clear();
+                {
+                        LOCKED;
+                        try {
+                                // the empty term's posting list has all documents.
+                                const auto& db{priv_->db()};
+                                auto it{db.postlist_begin({})};
+                                it.skip_to(next);
+                                for (; it != db.postlist_end({}) &&
+                                             chunk.size() != ChunkSize; ++it)
+                                        chunk.emplace_back(*it, db.get_document(*it).get_value(
+                                                                   MU_MSG_FIELD_ID_PATH));
+                        } MU_XAPIAN_CATCH_BLOCK_RETURN(n);
+                }
 
-                for (auto&& it = matches.begin(); it != matches.end(); ++it, ++n)
-                        if (!func (*it, it.get_document().get_value(MU_MSG_FIELD_ID_PATH)))
-                                break;
+                if (chunk.empty())
+                        break;
+                next = chunk.back().first + 1;
 
-        } MU_XAPIAN_CATCH_BLOCK;
+                for (auto&& id_path: chunk) {
+                        ++n;
+                        if (!func (id_path.first, id_path.second))
+                                return n;
+                }
+        }
 
         return n;
 }
@@ -989,13 +1245,15 @@ each_contact_info (MuMsgContact *contact, MsgDoc *msgdoc)
                 const auto flat = Mu::utf8_flatten(contact->email);
                 add_term(*msgdoc->_doc, pfx + flat);
                 add_address_subfields (*msgdoc->_doc, contact->email, pfx);
-                /* store it also in our contacts cache */
-                auto& contacts{msgdoc->_priv->contacts_};
-                contacts.add(Mu::ContactInfo(contact->full_address,
-                                             contact->email,
-                                             contact->name ? contact->name : "",
-                                             msgdoc->_personal,
-                                             mu_msg_get_date(msgdoc->_msg)));
+                /* store it also in our contacts cache; they're merged
+                 * with the others when needed, so this is cheap, also when
+                 * called from many threads. */
+                auto& contacts{msgdoc->_priv->contacts()};
+                contacts.add_pending(Mu::ContactInfo(contact->full_address,
+                                                     contact->email,
+                                                     contact->name ? contact->name : "",
+                                                     msgdoc->_personal,
+                                                     mu_msg_get_date(msgdoc->_msg)));
         }
 
         return TRUE;
@@ -1056,20 +1314,30 @@ update_threading_info (MuMsg *msg, Xapian::Document& doc)
 }
 
 
+// the complete document for a message; this does not touch the database, so it
+// can be called from multiple threads at the same time.
+Xapian::Document
+Store::Private::make_document (MuMsg *msg, const std::string& uid_term)
+{
+        Xapian::Document doc (new_doc_from_message(msg));
+
+        add_term (doc, uid_term);
+
+        // update the threading info if this message has a message id
+        if (mu_msg_get_msgid (msg))
+                update_threading_info (msg, doc);
+
+        return doc;
+}
+
 Xapian::docid
 Store::Private::add_or_update_msg (unsigned docid, MuMsg *msg, GError **err)
 {
         g_return_val_if_fail (msg, InvalidId);
 
         try {
-                Xapian::Document doc (new_doc_from_message(msg));
                 const std::string term (get_uid_term (mu_msg_get_path(msg)));
-
-                add_term (doc, term);
-
-                // update the threading info if this message has a message id
-                if (mu_msg_get_msgid (msg))
-                        update_threading_info (msg, doc);
+                Xapian::Document doc (make_document(msg, term));
 
 
                 if (docid == 0)
@@ -25,6 +25,7 @@
 #include <string>
 #include <vector>
 #include <mutex>
+#include <condition_variable>
 #include <ctime>
 
 
@@ -35,6 +36,43 @@
 #include <index/mu-indexer.hh>
 
 namespace Mu {
+
+/// The lock that the Store:: methods take. Xapian databases must not be used
+/// from multiple threads at the same time, so any code that uses the database
+/// (directly, or e.g. through Query / QueryResults) while another thread may be
+/// using the store, should hold it. The lock is recursive, so it's fine to call
+/// Store:: methods while holding it.
+///
+/// A thread that holds the lock for a long time (e.g., a 'find') can yield() it
+/// now and then to the threads waiting for it (e.g., a 'view', or the
+/// indexer); it blocks (rather than spins) until each of those had their turn.
+class StoreLock {
+public:
+        /**
+         * Acquire the lock, as with std::recursive_mutex.
+         */
+        void lock();
+
+        /**
+         * Release the lock, as with std::recursive_mutex.
+         */
+        void unlock();
+
+        /**
+         * If other threads are waiting for the lock, release it, let each of
+         * them acquire it, and re-acquire it. The caller must hold the lock,
+         * exactly once.
+         */
+        void yield();
+
+private:
+        std::recursive_mutex    mtx_;
+        std::mutex              waiters_mtx_;
+        std::condition_variable waiters_cv_;
+        size_t                  waiting_{};  /**< threads blocked in lock() */
+        size_t                  acquired_{}; /**< times they got the lock */
+};
+
 class Store {
 public:
         using Id = Xapian::docid;          /**< Id for a message in the store */
@@ -128,6 +166,13 @@ public:
          */
         Xapian::WritableDatabase& writable_database();
 
+        /**
+         * Get the lock that the Store:: methods take; see StoreLock.
+         *
+         * @return the lock
+         */
+        StoreLock& lock() const;
+
         /**
          * Get the Indexer associated with this store. It is an error to call
          * this on a read-only store.
@@ -145,6 +190,28 @@ public:
          */
         Id add_message (const std::string& path);
 
+        /// The outcome of adding a message with add_messages()
+        struct AddResult {
+                std::string path;          /**< Path of the message */
+                Id          id{InvalidId}; /**< Its doc id, or InvalidId if it failed */
+                std::string error;         /**< If it failed, the reason why */
+        };
+        using AddResults = std::vector<AddResult>;
+
+        /**
+         * Add a number of messages to the store. The messages are parsed in
+         * parallel (without holding the store lock), and then added in one
+         * go; so this is much faster than calling add_message() for each of
+         * them. Errors for the individual messages do not stop the others
+         * from being added; they are reported in the results rather than
+         * thrown.
+         *
+         * @param paths the message paths.
+         *
+         * @return the results, in the same order as the paths.
+         */
+        AddResults add_messages (const StringVec& paths);
+
         /**
          * Update a message in the store.
          *
@@ -173,13 +240,23 @@ public:
          */
         void remove_messages (const std::vector<Id>& ids);
 
+        /**
+         * Remove a number of messages from the store. It will _not_ remove the
+         * messages from the file system.
+         *
+         * @param paths the message paths.
+         *
+         * @return the number of messages that were removed.
+         */
+        size_t remove_messages (const StringVec& paths);
+
         /**
          * Remove a message from the store. It will _not_ remove the message
          * fromt he file system.
          *
          * @param id the store id for the message
          */
-        void remove_message (Id id) { remove_messages({id}); }
+        void remove_message (Id id) { remove_messages(std::vector<Id>{id}); }
 
         /**
          * Find message in the store.
@@ -210,8 +287,10 @@ public:
         using ForEachMessageFunc = std::function<bool(Id, const std::string&)>;
 
         /**
-         * Call @param func for each document in the store. This takes a lock on
-         * the store, so the func should _not_ call any other Store:: methods.
+         * Call @param func for each document in the store. This gets the paths
+         * in chunks, and calls func without holding the store lock, so other
+         * threads can use the store in the meantime (and func may call other
+         * Store:: methods).
          *
          * @param func a Callable invoked for each message.
          *
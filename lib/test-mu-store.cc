@@ -108,6 +108,69 @@ test_store_add_count_remove_in_memory ()
         g_assert_false(store.contains_message(MuTestMaildir2 + "/bar/cur/mail3"));
 }
 
+static void
+test_store_add_remove_many ()
+{
+	Mu::Store store{MuTestMaildir, {}, {}};
+
+        const Mu::StringVec paths = {
+                MuTestMaildir + "/cur/1220863042.12663_1.mindcrime!2,S",
+                MuTestMaildir + "/cur/1283599333.1840_11.cthulhu!2,",
+                MuTestMaildir + "/cur/no-such-message",
+                MuTestMaildir + "/new/1220863087.12663_21.mindcrime",
+                MuTestMaildir + "/cur/multimime!2,FS"
+        };
+
+        const auto results{store.add_messages(paths)};
+        g_assert_cmpuint(results.size(), ==, paths.size());
+        for (size_t i = 0; i != paths.size(); ++i) {
+                g_assert_cmpstr(results[i].path.c_str(), ==, paths[i].c_str());
+                if (i == 2) { // this one does not exist
+                        g_assert_cmpuint(results[i].id, ==, Mu::Store::InvalidId);
+                        g_assert_false(results[i].error.empty());
+                } else {
+                        g_assert_cmpuint(results[i].id, !=, Mu::Store::InvalidId);
+                        g_assert_true(store.contains_message(paths[i]));
+                }
+        }
+        g_assert_cmpuint(store.size(), ==, 4);
+
+        // adding them again replaces them
+        store.add_messages(paths);
+        g_assert_cmpuint(store.size(), ==, 4);
+
+        g_assert_cmpuint(store.remove_messages(paths), ==, 4);
+        g_assert_true(store.empty());
+}
+
+static void
+test_store_contacts_long_address ()
+{
+        char *tmpdir = test_mu_common_get_random_tmpdir();
+	g_assert (tmpdir);
+        const std::string dir{tmpdir};
+        g_free (tmpdir);
+
+        // an address too long for a metadata key...
+        const auto email{std::string(300, 'x') + "@example.com"};
+        const auto maildir{dir + "/maildir"};
+        g_assert_cmpint (g_mkdir_with_parents((maildir + "/cur").c_str(), 0700), ==, 0);
+        const auto msg{Mu::format("From: %s\nTo: y@example.com\n"
+                                  "Subject: long\n\nhello\n", email.c_str())};
+        g_assert_true (g_file_set_contents((maildir + "/cur/msg1:2,S").c_str(),
+                                           msg.c_str(), -1, NULL));
+        {
+                Mu::Store store{dir + "/db", maildir, {}, {}};
+                g_assert_cmpuint(store.add_message(maildir + "/cur/msg1:2,S"),
+                                 !=, Mu::Store::InvalidId);
+                g_assert_true (!!store.contacts()._find(email));
+        }
+
+        // ... still survives re-opening the store.
+        Mu::Store store{dir + "/db"};
+        g_assert_true (!!store.contacts()._find(email));
+}
+
 
 
 int
@@ -119,6 +182,8 @@ main (int argc, char *argv[])
 	g_test_add_func ("/store/ctor-dtor", test_store_ctor_dtor);
 	g_test_add_func ("/store/add-count-remove", test_store_add_count_remove);
         g_test_add_func ("/store/in-memory/add-count-remove", test_store_add_count_remove_in_memory);
+        g_test_add_func ("/store/in-memory/add-remove-many", test_store_add_remove_many);
+        g_test_add_func ("/store/contacts-long-address", test_store_contacts_long_address);
 
 	// if (!g_test_verbose())
 	// 	g_log_set_handler (NULL,
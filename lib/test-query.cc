@@ -70,6 +70,42 @@ test_query()
                 g_assert_cmpuint(res->size(),==,11);
                 dump_matches(*res);
         }
+
+        {
+                // the newest few should be the same as the first few of all.
+                const auto all = q.run("", MU_MSG_FIELD_ID_DATE, QueryFlags::Descending);
+                const auto res = q.run("", MU_MSG_FIELD_ID_DATE, QueryFlags::Descending, 3);
+                g_assert_true(!!all && !!res);
+                g_assert_cmpuint(res->size(),==,3);
+                dump_matches(*res);
+
+                auto it{all->begin()};
+                for (auto&& item: *res) {
+                        g_assert_cmpstr(item.date().value_or("").c_str(), ==,
+                                        it.date().value_or("").c_str());
+                        ++it;
+                }
+        }
+
+        // likewise, for queries with only a few matches (which use a narrower
+        // date window), and for fewer matches than we asked for.
+        for (auto&& qm: std::vector<std::pair<std::string, size_t>>{
+                        {"subject:sqlite", 2}, {"subject:dired", 10}}) {
+                for (auto&& flags: {QueryFlags::Descending, QueryFlags::None}) {
+                        const auto all = q.run(qm.first, MU_MSG_FIELD_ID_DATE, flags);
+                        const auto res = q.run(qm.first, MU_MSG_FIELD_ID_DATE, flags,
+                                               qm.second);
+                        g_assert_true(!!all && !!res);
+                        g_assert_cmpuint(res->size(),==,std::min(all->size(), qm.second));
+
+                        auto it{all->begin()};
+                        for (auto&& item: *res) {
+                                g_assert_cmpstr(item.date().value_or("").c_str(), ==,
+                                                it.date().value_or("").c_str());
+                                ++it;
+                        }
+                }
+        }
 }
 
 int
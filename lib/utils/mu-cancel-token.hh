@@ -0,0 +1,89 @@
+/*
+** Copyright (C) 2021 Dirk-Jan C. Binnema <djcb@djcbsoftware.nl>
+**
+** This program is free software; you can redistribute it and/or modify it
+** under the terms of the GNU General Public License as published by the
+** Free Software Foundation; either version 3, or (at your option) any
+** later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software Foundation,
+** Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+**
+*/
+
+#ifndef MU_CANCEL_TOKEN_HH__
+#define MU_CANCEL_TOKEN_HH__
+
+#include <atomic>
+#include <memory>
+
+#include "mu-error.hh"
+
+namespace Mu {
+
+/// A token through which a (long-running) operation can be cancelled from
+/// another thread; copies of a token share their state. A default-constructed
+/// token cannot be cancelled, and costs next to nothing to check.
+class CancelToken {
+public:
+        /**
+         * Make a new token that can be cancelled.
+         *
+         * @return a token
+         */
+        static CancelToken make() {
+                CancelToken token;
+                token.flag_ = std::make_shared<std::atomic<bool>>(false);
+                return token;
+        }
+
+        /**
+         * Cancel the operation(s) using this token (or a copy of it)
+         */
+        void cancel() const {
+                if (flag_)
+                        flag_->store(true);
+        }
+
+        /**
+         * Has this token been cancelled?
+         *
+         * @return true or false
+         */
+        bool cancelled() const {
+                return flag_ && flag_->load(std::memory_order_relaxed);
+        }
+
+        /**
+         * Throw an Error (with Error::Code::Cancelled) if this token has been
+         * cancelled.
+         */
+        void check() const {
+                if (G_UNLIKELY(cancelled()))
+                        throw Error{Error::Code::Cancelled, "operation was cancelled"};
+        }
+
+        /**
+         * Do both tokens share the same state?
+         *
+         * @param other some other token
+         *
+         * @return true or false
+         */
+        bool operator== (const CancelToken& other) const {
+                return flag_ == other.flag_;
+        }
+
+private:
+        std::shared_ptr<std::atomic<bool>> flag_;
+};
+
+} // namespace Mu
+
+#endif /* MU_CANCEL_TOKEN_HH__ */
@@ -42,6 +42,7 @@ struct Error final: public std::exception {
                 Query,
                 SchemaMismatch,
                 Store,
+                Cancelled,
         };
 
         /**
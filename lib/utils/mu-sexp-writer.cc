@@ -0,0 +1,189 @@
+/*
+** Copyright (C) 2021 Dirk-Jan C. Binnema <djcb@djcbsoftware.nl>
+**
+** This program is free software; you can redistribute it and/or modify it
+** under the terms of the GNU General Public License as published by the
+** Free Software Foundation; either version 3, or (at your option) any
+** later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software Foundation,
+** Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+**
+*/
+
+#include "mu-sexp-writer.hh"
+#include "mu-sexp.hh"
+
+using namespace Mu;
+
+SexpWriter&
+SexpWriter::begin_list()
+{
+        begin(format_ == Format::Json ? '[' : '(');
+        return *this;
+}
+
+SexpWriter&
+SexpWriter::end_list()
+{
+        end(format_ == Format::Json ? ']' : ')');
+        return *this;
+}
+
+SexpWriter&
+SexpWriter::begin_prop_list()
+{
+        begin(format_ == Format::Json ? '{' : '(');
+        return *this;
+}
+
+SexpWriter&
+SexpWriter::end_prop_list()
+{
+        end(format_ == Format::Json ? '}' : ')');
+        return *this;
+}
+
+SexpWriter&
+SexpWriter::prop (const char* name)
+{
+        if (format_ == Format::Json) {
+                string(name);
+                buf_ += ':';
+        } else {
+                separate();
+                buf_ += name;
+                buf_ += ' ';
+        }
+
+        need_sepa_ = false;
+        return *this;
+}
+
+SexpWriter&
+SexpWriter::string (const char* str, size_t len)
+{
+        static constexpr char hexchars[] = "0123456789abcdef";
+        const auto json{format_ == Format::Json};
+
+        separate();
+        buf_ += '"';
+
+        // copy runs of characters that do not need escaping in one go.
+        auto run{str};
+        const auto end{str + len};
+        for (auto cur = str; cur != end; ++cur) {
+                const auto kar{static_cast<unsigned char>(*cur)};
+                if (kar != '"' && kar != '\\' && (!json || kar >= 0x20))
+                        continue;
+
+                buf_.append(run, cur - run);
+                run = cur + 1;
+
+                buf_ += '\\';
+                switch (kar) {
+                case '"':
+                case '\\': buf_ += static_cast<char>(kar); break;
+                case '\n': buf_ += 'n'; break;
+                case '\r': buf_ += 'r'; break;
+                case '\t': buf_ += 't'; break;
+                case '\b': buf_ += 'b'; break;
+                case '\f': buf_ += 'f'; break;
+                default: // other control characters (JSON only)
+                        buf_ += "u00";
+                        buf_ += hexchars[kar >> 4];
+                        buf_ += hexchars[kar & 0xf];
+                }
+        }
+        buf_.append(run, end - run);
+
+        buf_ += '"';
+        need_sepa_ = true;
+
+        return *this;
+}
+
+SexpWriter&
+SexpWriter::number (int64_t num)
+{
+        char digits[24];
+        auto end{digits + sizeof(digits)}, cur{end};
+
+        auto unum{num < 0 ? 0ULL - static_cast<uint64_t>(num) : static_cast<uint64_t>(num)};
+        do {
+                *--cur = static_cast<char>('0' + unum % 10);
+                unum /= 10;
+        } while (unum != 0);
+        if (num < 0)
+                *--cur = '-';
+
+        separate();
+        buf_.append(cur, end - cur);
+        need_sepa_ = true;
+
+        return *this;
+}
+
+SexpWriter&
+SexpWriter::symbol (const char* sym)
+{
+        if (format_ == Format::Json) {
+                if (::strcmp(sym, Sexp::SymbolNil) == 0)
+                        sym = "false";
+                else if (::strcmp(sym, Sexp::SymbolT) == 0)
+                        sym = "true";
+                else
+                        return string(sym);
+        }
+
+        separate();
+        buf_ += sym;
+        need_sepa_ = true;
+
+        return *this;
+}
+
+SexpWriter&
+SexpWriter::sexp (const Sexp& sexp)
+{
+        switch (sexp.type()) {
+        case Sexp::Type::List:
+                if (format_ == Format::Json && sexp.is_prop_list()) {
+                        begin_prop_list();
+                        const auto& lst{sexp.list()};
+                        for (auto it = lst.begin(); it != lst.end(); it += 2) {
+                                prop(it->value().c_str());
+                                this->sexp(*(it + 1));
+                        }
+                        end_prop_list();
+                } else {
+                        begin_list();
+                        for (auto&& child: sexp.list())
+                                this->sexp(child);
+                        end_list();
+                }
+                break;
+        case Sexp::Type::String:
+                string(sexp.value());
+                break;
+        case Sexp::Type::Number:
+                separate();
+                buf_ += sexp.value();
+                need_sepa_ = true;
+                break;
+        case Sexp::Type::Symbol:
+                symbol(sexp.value().c_str());
+                break;
+        case Sexp::Type::Empty:
+        default:
+                break;
+        }
+
+        return *this;
+}
@@ -0,0 +1,164 @@
+/*
+** Copyright (C) 2021 Dirk-Jan C. Binnema <djcb@djcbsoftware.nl>
+**
+** This program is free software; you can redistribute it and/or modify it
+** under the terms of the GNU General Public License as published by the
+** Free Software Foundation; either version 3, or (at your option) any
+** later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software Foundation,
+** Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+**
+*/
+
+#ifndef MU_SEXP_WRITER_HH__
+#define MU_SEXP_WRITER_HH__
+
+#include <string>
+#include <cstdint>
+#include <cstring>
+
+namespace Mu {
+
+struct Sexp;
+
+/// Write-only builder for s-expressions, which writes them straight into a
+/// (growable) string buffer, rather than first building a tree of Sexp nodes
+/// and then converting that into a string.
+///
+/// Alternatively, it can write the JSON-equivalent, in the same way as
+/// Sexp::to_json_string(): property lists become objects, other lists become
+/// arrays and the nil / t symbols become false / true.
+///
+/// The writer takes care of the separators between items, so e.g.
+///
+///     writer.begin_prop_list().prop(":foo").number(123)
+///           .prop(":bar").begin_list().string("x").symbol("y").end_list()
+///           .end_prop_list();
+///
+/// gives (:foo 123 :bar ("x" y)), or {":foo":123,":bar":["x","y"]}.
+class SexpWriter {
+public:
+        /// The output format
+        enum struct Format {
+                Sexp, /**< S-expressions */
+                Json  /**< JSON */
+        };
+
+        /**
+         * Construct a SexpWriter
+         *
+         * @param buf buffer to append to
+         * @param format the output format
+         */
+        SexpWriter (std::string& buf, Format format = Format::Sexp):
+                buf_{buf}, format_{format} {}
+
+        /**
+         * Begin / end a list (JSON: array)
+         *
+         * @return the writer (for chaining)
+         */
+        SexpWriter& begin_list();
+        SexpWriter& end_list();
+
+        /**
+         * Begin / end a property list (JSON: object); its items must be
+         * prop() followed by some value.
+         *
+         * @return the writer (for chaining)
+         */
+        SexpWriter& begin_prop_list();
+        SexpWriter& end_prop_list();
+
+        /**
+         * Write a property name.
+         *
+         * @param name the name, must start with ':'
+         *
+         * @return the writer (for chaining)
+         */
+        SexpWriter& prop (const char* name);
+
+        /**
+         * Write a string, in double quotes, with escapes where needed.
+         *
+         * @param str a string
+         * @param len length of the string
+         *
+         * @return the writer (for chaining)
+         */
+        SexpWriter& string (const char* str, size_t len);
+        SexpWriter& string (const char* str)        { return string(str, ::strlen(str)); }
+        SexpWriter& string (const std::string& str) { return string(str.data(), str.size()); }
+
+        /**
+         * Write a number
+         *
+         * @param num some number
+         *
+         * @return the writer (for chaining)
+         */
+        SexpWriter& number (int64_t num);
+
+        /**
+         * Write a symbol
+         *
+         * @param sym symbol name; must be non-empty
+         *
+         * @return the writer (for chaining)
+         */
+        SexpWriter& symbol (const char* sym);
+
+        /**
+         * Write an existing Sexp
+         *
+         * @param sexp some Sexp
+         *
+         * @return the writer (for chaining)
+         */
+        SexpWriter& sexp (const Sexp& sexp);
+
+        /**
+         * Get the output format
+         *
+         * @return the format
+         */
+        Format format() const { return format_; }
+
+        /**
+         * Get the buffer we're writing to
+         *
+         * @return the buffer
+         */
+        const std::string& buffer() const { return buf_; }
+
+private:
+        void separate() {
+                if (need_sepa_)
+                        buf_ += format_ == Format::Json ? ',' : ' ';
+        }
+        void begin (char kar) {
+                separate();
+                buf_ += kar;
+                need_sepa_ = false;
+        }
+        void end (char kar) {
+                buf_ += kar;
+                need_sepa_ = true;
+        }
+
+        std::string& buf_;
+        const Format format_;
+        bool         need_sepa_{};
+};
+
+} // namespace Mu
+
+#endif /* MU_SEXP_WRITER_HH__ */
@@ -20,9 +20,9 @@
 
 
 #include "mu-sexp.hh"
+#include "mu-sexp-writer.hh"
 #include "mu-utils.hh"
 
-#include <sstream>
 #include <array>
 
 using namespace Mu;
@@ -181,80 +181,18 @@ Sexp::make_parse (const std::string& expr)
 std::string
 Sexp::to_sexp_string () const
 {
-        std::stringstream sstrm;
-
-        switch (type()) {
-        case Type::List: {
-                sstrm << '(';
-                bool first{true};
-                for (auto&& child : list()) {
-                        sstrm << (first ? "" : " ") << child.to_sexp_string();
-                        first = false;
-                }
-                sstrm << ')';
-                break;
-        }
-        case Type::String:
-                sstrm << quote(value());
-                break;
-        case Type::Number:
-        case Type::Symbol:
-        case Type::Empty:
-        default:
-                sstrm << value();
-        }
+        std::string str;
+        SexpWriter{str}.sexp(*this);
 
-        return sstrm.str();
+        return str;
 }
 
 
 std::string
 Sexp::to_json_string () const
 {
-        std::stringstream sstrm;
-
-        switch (type()) {
-        case Type::List: {
-                // property-lists become JSON objects
-                if (is_prop_list()) {
-                        sstrm << "{";
-                        auto it{list().begin()};
-                        bool first{true};
-                        while (it != list().end()) {
-                                sstrm << (first?"":",") << quote(it->value()) << ":";
-                                ++it;
-                                sstrm << it->to_json_string();
-                                ++it;
-                                first = false;
-                        }
-                        sstrm << "}";
-                } else { // other lists become arrays.
-                        sstrm << '[';
-                        bool first{true};
-                        for (auto&& child : list()) {
-                                sstrm << (first ? "" : ", ") << child.to_json_string();
-                                first = false;
-                        }
-                        sstrm << ']';
-                }
-                break;
-        }
-        case Type::String:
-                sstrm << quote(value());
-                break;
-        case Type::Symbol:
-                if (is_nil())
-                        sstrm << "false";
-                else if (is_t())
-                        sstrm << "true";
-                else
-                        sstrm << quote(value());
-                break;
-        case Type::Number:
-        case Type::Empty:
-        default:
-                sstrm << value();
-        }
+        std::string str;
+        SexpWriter{str, SexpWriter::Format::Json}.sexp(*this);
 
-        return sstrm.str();
+        return str;
 }
@@ -69,7 +69,7 @@ struct Sexp {
          */
         static Sexp make_string (std::string&& val)        { return Sexp{Type::String, std::move(val)}; }
         static Sexp make_string (const std::string& val)   { return Sexp{Type::String, std::string(val)}; }
-        static Sexp make_number (int val)                  { return Sexp{Type::Number, format("%d", val)}; }
+        static Sexp make_number (int val)                  { return Sexp{Type::Number, std::to_string(val)}; }
         static Sexp make_symbol (std::string&& val)        {
                 if (val.empty())
                         throw Error(Error::Code::InvalidArgument, "symbol must be non-empty");
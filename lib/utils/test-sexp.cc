@@ -24,6 +24,7 @@
 #include <sstream>
 
 #include "mu-command-parser.hh"
+#include "mu-sexp-writer.hh"
 #include "mu-utils.hh"
 
 using namespace Mu;
@@ -126,6 +127,48 @@ test_props()
                      "(:foo \"b\303\244r\" :cuux 123 :flub fnord :boo (\"foo\" 123 blub))");
 }
 
+static void
+test_writer()
+{
+        std::string buf;
+        SexpWriter writer{buf};
+
+        writer.begin_prop_list()
+                .prop(":foo").string("a \"b\"\n")
+                .prop(":num").number(-123)
+                .prop(":lst").begin_list().symbol("t").symbol("nil")
+                .begin_list().end_list().end_list()
+                .end_prop_list();
+        assert_equal(buf, "(:foo \"a \\\"b\\\"\n\" :num -123 :lst (t nil ()))");
+
+        buf.clear();
+        SexpWriter jwriter{buf, SexpWriter::Format::Json};
+        jwriter.begin_prop_list()
+                .prop(":foo").string("a \"b\"\n\001")
+                .prop(":num").number(-123)
+                .prop(":lst").begin_list().symbol("t").symbol("nil").symbol("x")
+                .begin_list().end_list().end_list()
+                .end_prop_list();
+        assert_equal(buf, "{\":foo\":\"a \\\"b\\\"\\n\\u0001\","
+                     "\":num\":-123,\":lst\":[true,false,\"x\",[]]}");
+}
+
+static void
+test_writer_sexp()
+{
+        auto sexp = Sexp::make_prop_list(
+                ":foo",  Sexp::make_string("bar"),
+                ":cuux", Sexp::make_list(Sexp::make_number(1),
+                                         Sexp::make_symbol("t")));
+
+        std::string buf;
+        SexpWriter{buf}.sexp(sexp);
+        assert_equal(buf, sexp.to_sexp_string());
+        assert_equal(buf, "(:foo \"bar\" :cuux (1 t))");
+
+        assert_equal(sexp.to_json_string(), "{\":foo\":\"bar\",\":cuux\":[1,true]}");
+}
+
 int
 main (int argc, char *argv[]) try
 {
@@ -140,6 +183,8 @@ main (int argc, char *argv[]) try
         g_test_add_func ("/utils/sexp/list",      test_list);
         g_test_add_func ("/utils/sexp/proplist",  test_prop_list);
         g_test_add_func ("/utils/sexp/props",     test_props);
+        g_test_add_func ("/utils/sexp/writer",    test_writer);
+        g_test_add_func ("/utils/sexp/writer-sexp", test_writer_sexp);
 
 	return g_test_run ();
 
@@ -19,6 +19,15 @@
 #include "config.h"
 
 #include <string>
+#include <algorithm>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <unordered_set>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -34,6 +43,7 @@
 #include "utils/mu-error.hh"
 #include "utils/mu-str.h"
 #include "utils/mu-date.h"
+#include "utils/mu-sexp-writer.hh"
 
 using namespace Mu;
 
@@ -84,16 +94,6 @@ guess_first_name (const char *name)
                 return g_strdup (name);
 }
 
-/**
- * guess some nick name for the given name; if we can determine an
- * first name, last name, the nick will be first name + the first char
- * of the last name. otherwise, it's just the first name. clearly,
- * this is just a rough guess for setting an initial value for nicks.
- *
- * @param name a name
- *
- * @return the guessed nick, as a newly allocated string (free with g_free)
- */
 static gchar*
 cleanup_str (const char* str)
 {
@@ -116,24 +116,18 @@ cleanup_str (const char* str)
         return s;
 }
 
-static char*
-uniquify_nick (const char *nick, GHashTable *nicks)
-{
-        guint u;
-
-        for (u = 2; u != 1000; ++u) {
-                char *cand;
-                cand = g_strdup_printf ("%s%u", nick, u);
-                if (!g_hash_table_contains (nicks, cand))
-                        return cand;
-        }
-
-        return g_strdup (nick); /* if all else fails */
-}
-
-
-static gchar*
-guess_nick (const char* name, GHashTable *nicks)
+/**
+ * guess some nick name for the given name; if we can determine an
+ * first name, last name, the nick will be first name + the first char
+ * of the last name. otherwise, it's just the first name. clearly,
+ * this is just a rough guess for setting an initial value for nicks.
+ *
+ * @param name a name
+ *
+ * @return the guessed nick; this is not necessarily unique, see uniquify_nick()
+ */
+static std::string
+guess_nick (const char* name)
 {
         gchar *fname, *lname, *nick;
         gchar initial[7];
@@ -168,16 +162,51 @@ leave:
                 nick = tmp;
         }
 
-        if (g_hash_table_contains (nicks, nick)) {
-                char *tmp;
-                tmp = uniquify_nick (nick, nicks);
-                g_free (nick);
-                nick = tmp;
-        }
+        std::string str{nick};
+        g_free (nick);
+
+        return str;
+}
+
+using Nicks = std::unordered_set<std::string>;
+
+/**
+ * Make a nick unique among the ones we've seen so far, and remember it.
+ *
+ * @param nick a nick
+ * @param nicks the nicks seen so far
+ *
+ * @return the unique nick
+ */
+static std::string
+uniquify_nick (std::string&& nick, Nicks& nicks)
+{
+        if (nicks.find(nick) != nicks.end()) {
+                for (unsigned u = 2; u != 1000; ++u) {
+                        auto cand{nick + std::to_string(u)};
+                        if (nicks.find(cand) == nicks.end()) {
+                                nick = std::move(cand);
+                                break;
+                        }
+                }
+        } /* if all else fails, use the nick as-is */
+
+        nicks.emplace(nick);
+
+        return std::move(nick);
+}
+
+static std::string
+date_str (const char *frm, time_t t, bool utc=false)
+{
+        struct tm tm{};
+        char buf[64];
 
-        g_hash_table_add (nicks, g_strdup(nick));
+        if (!(utc ? gmtime_r(&t, &tm) : localtime_r(&t, &tm)) ||
+            strftime(buf, sizeof(buf), frm, &tm) == 0)
+                return {};
 
-        return nick;
+        return buf;
 }
 
 static void
@@ -191,160 +220,301 @@ print_header (const MuConfigFormat format)
         case MU_CONFIG_FORMAT_MUTT_AB:
                 g_print ("Matching addresses in the mu database:\n");
                 break;
+        case MU_CONFIG_FORMAT_JSON:
+                g_print ("[");
+                break;
         default:
                 break;
         }
 }
 
 static void
-each_contact_bbdb (const std::string& email, const std::string& name, time_t tstamp)
+print_footer (const MuConfigFormat format)
 {
-        char *fname, *lname, *now, *timestamp;
-
-        fname	  = guess_first_name (name.c_str());
-        lname	  = guess_last_name (name.c_str());
-        now	  = mu_date_str ("%Y-%m-%d", time(NULL));
-        timestamp = mu_date_str ("%Y-%m-%d", tstamp);
+        if (format == MU_CONFIG_FORMAT_JSON)
+                g_print ("\n]\n");
+}
 
-        g_print ("[\"%s\" \"%s\" nil nil nil nil (\"%s\") "
-                 "((creation-date . \"%s\") (time-stamp . \"%s\")) nil]\n",
-                 fname, lname, email.c_str(), now, timestamp);
+using Chunk = std::vector<Mu::ContactInfo>;
 
-        g_free (now);
-        g_free (timestamp);
-        g_free (fname);
-        g_free (lname);
-}
+/// The output for a chunk of contacts. Nicks can only be made unique in the
+/// order of the output, so we leave gaps for them, which we fill when writing.
+struct FormattedChunk {
+        std::string                                      text;
+        std::vector<std::pair<std::size_t, std::string>> nicks; // offset, nick
+        std::size_t                                      n{};   // number of contacts
+};
 
+struct ECData {
+        MuConfigFormat  format;
+        gboolean        color;
+        GRegex         *rx;
+        std::string     now;   // today's date, for bbdb
+};
 
 static void
-each_contact_mutt_alias (const std::string& email, const std::string& name,
-                         GHashTable *nicks)
+format_bbdb (const Mu::ContactInfo& ci, const ECData& ecdata, std::string& out)
 {
-        if (name.empty())
-                return;
+        char *fname, *lname;
 
-        char *nick = guess_nick (name.c_str(), nicks);
-        mu_util_print_encoded ("alias %s %s <%s>\n",
-                               nick, name.c_str(), email.c_str());
-        g_free (nick);
-}
+        fname	  = guess_first_name (ci.name.c_str());
+        lname	  = guess_last_name (ci.name.c_str());
 
+        out += Mu::format ("[\"%s\" \"%s\" nil nil nil nil (\"%s\") "
+                           "((creation-date . \"%s\") (time-stamp . \"%s\")) nil]\n",
+                           fname, lname, ci.email.c_str(), ecdata.now.c_str(),
+                           date_str("%Y-%m-%d", ci.last_seen).c_str());
+        g_free (fname);
+        g_free (lname);
+}
 
 static void
-each_contact_wl (const std::string& email, const std::string& name, GHashTable *nicks)
+format_json (const Mu::ContactInfo& ci, std::string& out)
 {
-        if (name.empty())
-                return;
-
-        char *nick = guess_nick (name.c_str(), nicks);
-        mu_util_print_encoded ("%s \"%s\" \"%s\"\n", email.c_str(), nick, name.c_str());
-        g_free (nick);
+        // each but the first contact is preceded by a comma; we remove the
+        // first one when writing.
+        out += ",\n  ";
+
+        SexpWriter writer{out, SexpWriter::Format::Json};
+        writer.begin_prop_list()
+                .prop("email").string(ci.email)
+                .prop("name").string(ci.name)
+                .prop("full-address").string(ci.full_address)
+                .prop("personal").symbol(ci.personal ? "t" : "nil")
+                .prop("freq").number(static_cast<int64_t>(ci.freq))
+                .prop("last-seen").number(static_cast<int64_t>(ci.last_seen))
+                .end_prop_list();
 }
 
 static void
-print_plain (const std::string& email, const std::string& name, bool color)
+format_plain (const Mu::ContactInfo& ci, bool color, std::string& out)
 {
-        if (!name.empty()) {
+        if (!ci.name.empty()) {
                 if (color)
-                        ::fputs (MU_COLOR_MAGENTA, stdout);
-                mu_util_fputs_encoded (name.c_str(), stdout);
-                ::fputs (" ", stdout);
+                        out += MU_COLOR_MAGENTA;
+                out += ci.name;
+                out += ' ';
         }
 
         if (color)
-                ::fputs (MU_COLOR_GREEN, stdout);
-
-        mu_util_fputs_encoded (email.c_str(), stdout);
-
+                out += MU_COLOR_GREEN;
+        out += ci.email;
         if (color)
-                fputs (MU_COLOR_DEFAULT, stdout);
+                out += MU_COLOR_DEFAULT;
 
-        fputs ("\n", stdout);
+        out += '\n';
 }
 
-struct ECData {
-        MuConfigFormat  format;
-        gboolean        color, personal;
-        time_t          after;
-        GRegex         *rx;
-        GHashTable     *nicks;
-        size_t          n;
-};
-
 static void
-each_contact (const Mu::ContactInfo& ci, ECData& ecdata)
+format_contact (const Mu::ContactInfo& ci, const ECData& ecdata, FormattedChunk& chunk)
 {
-        if (ecdata.personal && ci.personal)
-                return;
-
-        if (ci.tstamp < ecdata.after)
-                return;
-
         if (ecdata.rx &&
             !g_regex_match (ecdata.rx, ci.email.c_str(), (GRegexMatchFlags)0, NULL) &&
             !g_regex_match (ecdata.rx, ci.name.empty() ? "" : ci.name.c_str(), (GRegexMatchFlags)0, NULL))
                 return;
 
-        ++ecdata.n;
+        ++chunk.n;
+
+        auto& out{chunk.text};
+        const auto add_nick = [&] {
+                chunk.nicks.emplace_back(out.size(), guess_nick(ci.name.c_str()));
+        };
 
         switch (ecdata.format) {
         case MU_CONFIG_FORMAT_MUTT_ALIAS:
-                each_contact_mutt_alias (ci.email, ci.name, ecdata.nicks);
+                if (ci.name.empty())
+                        break;
+                out += "alias ";
+                add_nick();
+                out += ' ' + ci.name + " <" + ci.email + ">\n";
                 break;
         case MU_CONFIG_FORMAT_MUTT_AB:
-                mu_util_print_encoded ("%s\t%s\t\n",
-                                       ci.email.c_str(), ci.name.c_str());
+                out += ci.email + '\t' + ci.name + "\t\n";
                 break;
         case MU_CONFIG_FORMAT_WL:
-                each_contact_wl (ci.email, ci.name, ecdata.nicks);
+                if (ci.name.empty())
+                        break;
+                out += ci.email + " \"";
+                add_nick();
+                out += "\" \"" + ci.name + "\"\n";
                 break;
         case MU_CONFIG_FORMAT_ORG_CONTACT:
                 if (!ci.name.empty())
-                        mu_util_print_encoded("* %s\n:PROPERTIES:\n:EMAIL: %s\n:END:\n\n",
-                                              ci.name.c_str(), ci.email.c_str());
+                        out += "* " + ci.name + "\n:PROPERTIES:\n:EMAIL: " +
+                                ci.email + "\n:END:\n\n";
                 break;
         case MU_CONFIG_FORMAT_BBDB:
-                each_contact_bbdb (ci.email, ci.name, ci.last_seen);
+                format_bbdb (ci, ecdata, out);
                 break;
         case MU_CONFIG_FORMAT_CSV:
-                mu_util_print_encoded("%s,%s\n",
-                                      ci.name.empty() ? "" : Mu::quote(ci.name).c_str(),
-                                      Mu::quote(ci.email).c_str());
+                out += (ci.name.empty() ? "" : Mu::quote(ci.name)) + ',' +
+                        Mu::quote(ci.email) + '\n';
+                break;
+        case MU_CONFIG_FORMAT_JSON:
+                format_json (ci, out);
+                break;
+        case MU_CONFIG_FORMAT_DEBUG:
+                out += Mu::format ("%s\n\tname: %s\n\t%s\n\tpersonal: %s\n\tfreq: %zu\n"
+                                   "\tlast-seen: %s\n",
+                                   ci.email.c_str(),
+                                   ci.name.empty() ? "<none>" : ci.name.c_str(),
+                                   ci.full_address.c_str(),
+                                   ci.personal ? "yes" : "no",
+                                   ci.freq,
+                                   date_str("%F %T", ci.last_seen, true/*utc*/).c_str());
                 break;
-        case MU_CONFIG_FORMAT_DEBUG: {
-                char datebuf[32];
-                strftime(datebuf,  sizeof(datebuf), "%F %T",
-                         gmtime(&ci.last_seen));
-                g_print ("%s\n\tname: %s\n\t%s\n\tpersonal: %s\n\tfreq: %zu\n"
-                         "\tlast-seen: %s\n",
-                         ci.email.c_str(),
-                         ci.name.empty() ? "<none>" : ci.name.c_str(),
-                         ci.full_address.c_str(),
-                         ci.personal ? "yes" : "no",
-                         ci.freq,
-                         datebuf);
-        } break;
         default:
-                print_plain (ci.email, ci.name, ecdata.color);
+                format_plain (ci, ecdata.color, out);
         }
 }
 
+static FormattedChunk
+format_chunk (Chunk&& chunk, const ECData& ecdata)
+{
+        FormattedChunk formatted;
+        for (auto&& ci: chunk)
+                format_contact (ci, ecdata, formatted);
+
+        return formatted;
+}
+
+static void
+write_encoded (const std::string& str)
+{
+        if (mu_util_locale_is_utf8()) {
+                ::fwrite (str.data(), 1, str.size(), stdout);
+                return;
+        }
+
+        // convert line-by-line, so a line that cannot be converted does not
+        // spoil the others.
+        std::size_t pos{};
+        while (pos < str.size()) {
+                auto end{str.find('\n', pos)};
+                end = end == std::string::npos ? str.size() : end + 1;
+                mu_util_fputs_encoded (str.substr(pos, end - pos).c_str(), stdout);
+                pos = end;
+        }
+}
+
+/// Formats chunks of contacts in a number of worker threads, and passes the
+/// results, in the original order, to some consumer. Only a few chunks are in
+/// flight at any time, so the output is streamed, even for very many contacts.
+class ChunkPipeline {
+public:
+        using FormatFunc  = std::function<FormattedChunk(Chunk&&)>;
+        using ConsumeFunc = std::function<void(FormattedChunk&&)>;
+
+        ChunkPipeline (FormatFunc&& format_func, ConsumeFunc&& consume_func):
+                format_func_{std::move(format_func)},
+                consume_func_{std::move(consume_func)} {
+
+                const auto n{std::max(1U, std::thread::hardware_concurrency())};
+                max_in_flight_ = 2 * n;
+                for (auto i = 0U; i != n; ++i)
+                        workers_.emplace_back([this]{ work(); });
+        }
+
+        ~ChunkPipeline() { finish(); }
+
+        /**
+         * Add a chunk for formatting; this may consume the results for
+         * earlier chunks.
+         *
+         * @param chunk a chunk of contacts
+         */
+        void push (Chunk&& chunk) {
+                std::unique_lock<std::mutex> lock{mtx_};
+                while (slots_.size() >= max_in_flight_)
+                        consume_first(lock);
+
+                slots_.emplace_back(Slot{std::move(chunk), {}});
+                cv_.notify_all();
+        }
+
+        /**
+         * Consume all outstanding chunks, and stop the workers.
+         */
+        void finish () {
+                std::unique_lock<std::mutex> lock{mtx_};
+                while (!slots_.empty())
+                        consume_first(lock);
+
+                done_ = true;
+                cv_.notify_all();
+                lock.unlock();
+
+                for (auto&& worker: workers_)
+                        worker.join();
+                workers_.clear();
+        }
+
+private:
+        struct Slot {
+                Chunk                           chunk;
+                std::unique_ptr<FormattedChunk> formatted;
+        };
+
+        void consume_first (std::unique_lock<std::mutex>& lock) {
+                cv_.wait(lock, [this]{ return !!slots_.front().formatted; });
+                auto formatted{std::move(slots_.front().formatted)};
+                slots_.pop_front();
+                ++first_;
+                cv_.notify_all();
+
+                lock.unlock();
+                consume_func_(std::move(*formatted));
+                lock.lock();
+        }
+
+        void work () {
+                std::unique_lock<std::mutex> lock{mtx_};
+                while (true) {
+                        cv_.wait(lock, [this]{ return done_ || next_ < first_ + slots_.size(); });
+                        if (next_ == first_ + slots_.size())
+                                return; // done
+                        const auto idx{next_++};
+                        auto chunk{std::move(slots_[idx - first_].chunk)};
+
+                        lock.unlock();
+                        auto formatted{std::make_unique<FormattedChunk>(
+                                        format_func_(std::move(chunk)))};
+                        lock.lock();
+
+                        slots_[idx - first_].formatted = std::move(formatted);
+                        cv_.notify_all();
+                }
+        }
+
+        const FormatFunc         format_func_;
+        const ConsumeFunc        consume_func_;
+        std::size_t              max_in_flight_{};
+
+        std::mutex               mtx_;
+        std::condition_variable  cv_;
+        std::deque<Slot>         slots_;
+        std::size_t              first_{}; // number of the chunk in slots_.front()
+        std::size_t              next_{};  // number of the next chunk to format
+        bool                     done_{};
+        std::vector<std::thread> workers_;
+};
+
+constexpr std::size_t ChunkSize = 4096; // contacts per chunk
 
 static MuError
 run_cmd_cfind (const Mu::Store&       store,
                const char*            pattern,
                gboolean               personal,
                time_t                 after,
+               gboolean               complete,
+               int                    maxnum,
                const MuConfigFormat   format,
                gboolean               color,
                GError               **err)
 {
-        ECData	 ecdata{};
-
-        memset(&ecdata, 0, sizeof(ecdata));
+        ECData ecdata{};
 
-        if (pattern) {
+        if (pattern && !complete) {
                 ecdata.rx = g_regex_new (pattern,
                                          (GRegexCompileFlags)(G_REGEX_CASELESS|G_REGEX_OPTIMIZE),
                                          (GRegexMatchFlags)0, err);
@@ -352,24 +522,72 @@ run_cmd_cfind (const Mu::Store&       store,
                         return MU_ERROR_CONTACTS;
         }
 
-        ecdata.personal = personal;
-        ecdata.n        = 0;
-        ecdata.after    = after;
-        ecdata.format	= format;
-        ecdata.color	= color;
-        ecdata.nicks    = g_hash_table_new_full (g_str_hash, g_str_equal,
-                                                 g_free, NULL);
+        ecdata.format = format;
+        ecdata.color  = color;
+        ecdata.now    = date_str("%Y-%m-%d", ::time({}));
 
         print_header (format);
 
-        store.contacts().for_each([&](const auto& ci) { each_contact(ci, ecdata); });
-
-        g_hash_table_unref (ecdata.nicks);
+        // the contacts are formatted in parallel, in chunks; we write the
+        // results in order, so the output is the same as when formatting them
+        // one-by-one; and we make the nicks unique here.
+        std::size_t n{};
+        Nicks       nicks;
+        std::string out;
+        bool        first{true};
+        ChunkPipeline pipeline{
+                [&](Chunk&& chunk) { return format_chunk(std::move(chunk), ecdata); },
+                [&](FormattedChunk&& formatted) {
+                        n += formatted.n;
+                        auto& text{formatted.text};
+                        if (format == MU_CONFIG_FORMAT_JSON && first && !text.empty())
+                                text.erase(0, 1); // the first one has no comma.
+                        first = first && text.empty();
+
+                        out.clear();
+                        std::size_t pos{};
+                        for (auto&& nick: formatted.nicks) {
+                                out.append(text, pos, nick.first - pos);
+                                out += uniquify_nick(std::move(nick.second), nicks);
+                                pos = nick.first;
+                        }
+                        out.append(text, pos, std::string::npos);
+                        write_encoded(out);
+                }};
+
+        Chunk chunk;
+        const auto each = [&](const Mu::ContactInfo& ci) {
+                chunk.emplace_back(ci);
+                if (chunk.size() == ChunkSize) {
+                        pipeline.push(std::move(chunk));
+                        chunk = {};
+                }
+        };
+
+        if (complete) {
+                // use the completion index; it gives us the best matches for
+                // the prefix, so we filter before, rather than after.
+                store.contacts().complete(
+                        pattern ? pattern : "", std::max(maxnum, 0), each,
+                        [&](const auto& ci) {
+                                return (!personal || ci.personal) && ci.last_seen >= after;
+                        });
+        } else
+                store.contacts().for_each([&](const auto& ci) {
+                        if ((!personal || ci.personal) && ci.last_seen >= after)
+                                each(ci);
+                });
+
+        if (!chunk.empty())
+                pipeline.push(std::move(chunk));
+        pipeline.finish();
+
+        print_footer (format);
 
         if (ecdata.rx)
                 g_regex_unref (ecdata.rx);
 
-        if (ecdata.n == 0) {
+        if (n == 0) {
                 g_printerr ("no matching contacts found\n");
                 return MU_ERROR_NO_MATCHES;
         }
@@ -387,6 +605,7 @@ cfind_params_valid (const MuConfig *opts)
         case MU_CONFIG_FORMAT_WL:
         case MU_CONFIG_FORMAT_BBDB:
         case MU_CONFIG_FORMAT_CSV:
+        case MU_CONFIG_FORMAT_JSON:
         case MU_CONFIG_FORMAT_ORG_CONTACT:
         case MU_CONFIG_FORMAT_DEBUG:
                 break;
@@ -420,6 +639,8 @@ Mu::mu_cmd_cfind (const Mu::Store& store, const MuConfig *opts, GError **err)
                                   opts->params[1],
                                   opts->personal,
                                   opts->after,
+                                  opts->complete,
+                                  opts->maxnum,
                                   opts->format,
                                   !opts->nocolor,
                                   err);
@@ -23,6 +23,7 @@
 #include <algorithm>
 #include <atomic>
 #include <cstdio>
+#include <cerrno>
 
 #include <unistd.h>
 
@@ -38,6 +39,7 @@
 using namespace Mu;
 static std::atomic<bool> MuTerminate{false};
 static bool tty;
+static bool json_lines; // output JSON, one object per line (no cookies)
 
 static void
 install_sig_handler (void)
@@ -65,26 +67,64 @@ install_sig_handler (void)
 #define COOKIE_PRE  "\376"
 #define COOKIE_POST "\377"
 
+// we gather the output here, and write it out in one go after each command (or
+// whenever the server asks us to flush, or the buffer gets big, so a large
+// find does not keep all its headers in memory). The server serializes the
+// calls to output_sexp_stdout, so no locking is needed.
+static std::string OutputBuffer;
+constexpr size_t   OutputBufferMax = 64 * 1024;
+
 static void
 cookie(size_t n)
 {
+        char buf[32];
         const auto num{static_cast<unsigned>(n)};
+        const auto len{tty ? // for testing.
+                        ::snprintf(buf, sizeof(buf), "[%x]", num) :
+                        ::snprintf(buf, sizeof(buf), COOKIE_PRE "%x" COOKIE_POST, num)};
 
-        if (tty) // for testing.
-                ::printf ("[%x]", num);
-        else
-                ::printf (COOKIE_PRE "%x" COOKIE_POST, num);
+        OutputBuffer.append(buf, len);
 }
 
 static void
-output_sexp_stdout (Sexp&& sexp)
+flush_output ()
 {
-        const auto str{sexp.to_sexp_string()};
-        cookie(str.size() + 1);
-        if (G_UNLIKELY(::puts(str.c_str()) < 0)) {
-                g_critical ("failed to write output '%s'", str.c_str());
-                ::raise (SIGTERM); /* terminate ourselves */
+        std::fflush(stdout); // for anything written through stdio.
+
+        const char *data{OutputBuffer.data()};
+        size_t left{OutputBuffer.size()};
+        while (left > 0) {
+                const auto n{::write(STDOUT_FILENO, data, left)};
+                if (n < 0 && errno == EINTR)
+                        continue;
+                else if (G_UNLIKELY(n < 0)) {
+                        g_critical ("failed to write output: %s", g_strerror(errno));
+                        ::raise (SIGTERM); /* terminate ourselves */
+                        break;
+                }
+                data += n;
+                left -= n;
         }
+
+        OutputBuffer.clear();
+}
+
+static void
+output_sexp_stdout (const std::string& str,
+                    Server::OutputFlags flags = Server::OutputFlags::None)
+{
+        if (!str.empty()) {
+                // JSON never contains a raw newline, so the newline is all the
+                // framing we need.
+                if (!json_lines)
+                        cookie(str.size() + 1);
+                OutputBuffer += str;
+                OutputBuffer += '\n';
+        }
+
+        if (any_of(flags & Server::OutputFlags::Flush) ||
+            OutputBuffer.size() >= OutputBufferMax)
+                flush_output();
 }
 
 static void
@@ -95,14 +135,31 @@ report_error(const Mu::Error& err) noexcept
         e.add_prop(":error",   Sexp::make_number(static_cast<size_t>(err.code())));
         e.add_prop(":message", Sexp::make_string(err.what()));
 
-        output_sexp_stdout(Sexp::make_list(std::move(e)));
+        const auto sexp{Sexp::make_list(std::move(e))};
+        output_sexp_stdout(json_lines ? sexp.to_json_string() : sexp.to_sexp_string());
+        flush_output();
 }
 
 MuError
 Mu::mu_cmd_server (const MuConfig *opts, GError **err) try {
 
+        SexpWriter::Format format{SexpWriter::Format::Sexp};
+        if (opts->formatstr) {
+                if (opts->format == MU_CONFIG_FORMAT_JSON)
+                        format = SexpWriter::Format::Json;
+                else if (opts->format != MU_CONFIG_FORMAT_SEXP)
+                        throw Error(Error::Code::InvalidArgument,
+                                    "unsupported format '%s'", opts->formatstr);
+        }
+        json_lines = format == SexpWriter::Format::Json;
+
+        if (opts->readable_max_age < 0)
+                throw Error(Error::Code::InvalidArgument,
+                            "invalid readable-max-age %d", opts->readable_max_age);
+
         Store store{mu_runtime_path(MU_RUNTIME_PATH_XAPIANDB), false/*writable*/};
-        Server server{store, output_sexp_stdout};
+        Server server{store, output_sexp_stdout, format,
+                      std::chrono::seconds(opts->readable_max_age)};
 
         g_message ("created server with store @ %s; maildir @ %s; debug-mode %s",
                    store.metadata().database_path.c_str(),
@@ -115,7 +172,7 @@ Mu::mu_cmd_server (const MuConfig *opts, GError **err) try {
                 opts->commands ? "(help :full t)" : opts->eval ? opts->eval : ""};
         if (!eval.empty()) {
                 server.invoke(eval);
-                return MU_OK;
+                return MU_OK; // the server finishes the command on destruction.
         }
 
         // Note, the readline stuff is inactive unless on a tty.
@@ -123,8 +180,9 @@ Mu::mu_cmd_server (const MuConfig *opts, GError **err) try {
         setup_readline(histpath, 50);
 
         install_sig_handler();
-        std::cout << ";; Welcome to the "  << PACKAGE_STRING << " command-server\n"
-                  << ";; Use (help) to get a list of commands, (quit) to quit.\n";
+        if (!json_lines)
+                std::cout << ";; Welcome to the "  << PACKAGE_STRING << " command-server\n"
+                          << ";; Use (help) to get a list of commands, (quit) to quit.\n";
 
         bool do_quit{};
         while (!MuTerminate && !do_quit) {
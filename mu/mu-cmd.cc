@@ -315,14 +315,14 @@ check_file_okay (const char *path, gboolean cmd_add)
 	return TRUE;
 }
 
-typedef bool (*ForeachMsgFunc) (Mu::Store& store, const char *path, GError **err);
-
-static MuError
-foreach_msg_file (Mu::Store& store, const MuConfig *opts,
-		  ForeachMsgFunc foreach_func, GError **err)
+/* get the message files from the command line (params[1..]), skipping (and
+ * complaining about) the ones that are not okay; return FALSE if there are no
+ * paths at all, and set *all_ok to FALSE if we skipped some */
+static gboolean
+get_msg_files (const MuConfig *opts, StringVec& paths, gboolean *all_ok,
+	       GError **err)
 {
-	unsigned	u;
-	gboolean	all_ok;
+	unsigned u;
 
 	/* note: params[0] will be 'add' */
 	if (!opts->params[0] || !opts->params[1]) {
@@ -330,31 +330,30 @@ foreach_msg_file (Mu::Store& store, const MuConfig *opts,
 			 opts->params[0] ? opts->params[0] : "<cmd>");
 		mu_util_g_set_error (err, MU_ERROR_IN_PARAMETERS,
 				     "missing parameters");
-		return MU_ERROR_IN_PARAMETERS;
+		return FALSE;
 	}
 
-	for (u = 1, all_ok = TRUE; opts->params[u]; ++u) {
+	for (u = 1, *all_ok = TRUE; opts->params[u]; ++u) {
 
 		const char* path;
 
 		path = opts->params[u];
 
 		if (!check_file_okay (path, TRUE)) {
-			all_ok = FALSE;
+			*all_ok = FALSE;
 			g_printerr ("not a valid message file: %s\n", path);
 			continue;
 		}
 
-		if (!foreach_func (store, path, err)) {
-			all_ok = FALSE;
-			g_printerr ("error with %s: %s\n", path,
-                                    (err&&*err) ? (*err)->message :
-                                   "something went wrong");
-			g_clear_error (err);
-			continue;
-		}
+		paths.emplace_back (path);
 	}
 
+	return TRUE;
+}
+
+static MuError
+msg_files_result (const MuConfig *opts, gboolean all_ok, GError **err)
+{
 	if (!all_ok) {
 		mu_util_g_set_error (err, MU_ERROR_XAPIAN_STORE_FAILED,
 				     "%s failed for some message(s)",
@@ -365,44 +364,77 @@ foreach_msg_file (Mu::Store& store, const MuConfig *opts,
 	return MU_OK;
 }
 
+typedef bool (*ForeachMsgFunc) (Mu::Store& store, const char *path, GError **err);
 
-static bool
-add_path_func (Mu::Store& store, const char *path, GError **err)
+static MuError
+foreach_msg_file (Mu::Store& store, const MuConfig *opts,
+		  ForeachMsgFunc foreach_func, GError **err)
 {
-        const auto docid = store.add_message (path);
-        g_debug ("added message @ %s, docid=%u", path, docid);
+	StringVec	paths;
+	gboolean	all_ok;
+
+	if (!get_msg_files (opts, paths, &all_ok, err))
+		return MU_ERROR_IN_PARAMETERS;
 
-        return true;
+	for (auto&& path: paths) {
+		if (!foreach_func (store, path.c_str(), err)) {
+			all_ok = FALSE;
+			g_printerr ("error with %s: %s\n", path.c_str(),
+                                    (err&&*err) ? (*err)->message :
+                                   "something went wrong");
+			g_clear_error (err);
+			continue;
+		}
+	}
+
+	return msg_files_result (opts, all_ok, err);
 }
 
 
 static MuError
 cmd_add (Mu::Store& store, const MuConfig *opts, GError **err)
 {
+	StringVec	paths;
+	gboolean	all_ok;
+
 	g_return_val_if_fail (opts, MU_ERROR_INTERNAL);
 	g_return_val_if_fail (opts->cmd == MU_CONFIG_CMD_ADD,
 			      MU_ERROR_INTERNAL);
 
-	return foreach_msg_file (store, opts, add_path_func, err);
-}
+	if (!get_msg_files (opts, paths, &all_ok, err))
+		return MU_ERROR_IN_PARAMETERS;
 
-static bool
-remove_path_func (Mu::Store& store, const char *path, GError **err)
-{
-        const auto res = store.remove_message (path);
-        g_debug ("removed %s (%s)", path, res ? "yes" : "no");
+	/* add them in one go; that's much faster for many messages */
+	for (auto&& res: store.add_messages (paths)) {
+		if (res.id == Store::InvalidId) {
+			all_ok = FALSE;
+			g_printerr ("error with %s: %s\n", res.path.c_str(),
+				    res.error.c_str());
+		} else
+			g_debug ("added message @ %s, docid=%u",
+				 res.path.c_str(), res.id);
+	}
 
-        return true;
+	return msg_files_result (opts, all_ok, err);
 }
 
 static MuError
 cmd_remove (Mu::Store& store, const MuConfig *opts, GError **err)
 {
+	StringVec	paths;
+	gboolean	all_ok;
+
 	g_return_val_if_fail (opts, MU_ERROR_INTERNAL);
 	g_return_val_if_fail (opts->cmd == MU_CONFIG_CMD_REMOVE,
 			      MU_ERROR_INTERNAL);
 
-	return foreach_msg_file (store, opts, remove_path_func, err);
+	if (!get_msg_files (opts, paths, &all_ok, err))
+		return MU_ERROR_IN_PARAMETERS;
+
+	const auto n = store.remove_messages (paths);
+	g_debug ("removed %zu of %zu message(s)", n, paths.size());
+
+	return msg_files_result (opts, all_ok, err);
 }
 
 static bool
@@ -260,6 +260,10 @@ config_options_group_find ()
 		 "<len>"},
 		{"exec", 'e', 0, G_OPTION_ARG_STRING, &MU_CONFIG.exec,
 		 "execute command on each match message", "<command>"},
+		{"jobs", 'j', 0, G_OPTION_ARG_INT, &MU_CONFIG.jobs,
+		 "run up to <n> --exec commands in parallel (1)", "<n>"},
+		{"max-args", 0, 0, G_OPTION_ARG_INT, &MU_CONFIG.max_args,
+		 "pass up to <n> messages to each --exec command (1)", "<n>"},
 		{"after", 0, 0, G_OPTION_ARG_INT, &MU_CONFIG.after,
 		 "only show messages whose m_time > T (t_time)",
 		 "<timestamp>"},
@@ -310,11 +314,15 @@ config_options_group_cfind ()
 	GOptionEntry entries[] = {
 		{"format", 'o', 0, G_OPTION_ARG_STRING, &MU_CONFIG.formatstr,
 		 "output format (plain(*), mutt-alias, mutt-ab, wl, "
-		 "org-contact, bbdb, csv)", "<format>"},
+		 "org-contact, bbdb, csv, json)", "<format>"},
 		{"personal", 0, 0, G_OPTION_ARG_NONE, &MU_CONFIG.personal,
 		 "whether to only get 'personal' contacts", NULL},
 		{"after", 0, 0, G_OPTION_ARG_INT, &MU_CONFIG.after,
 		 "only get addresses last seen after T", "<timestamp>"},
+		{"complete", 0, 0, G_OPTION_ARG_NONE, &MU_CONFIG.complete,
+		 "complete the pattern as a prefix of a name or address", NULL},
+		{"maxnum", 'n', 0, G_OPTION_ARG_INT, &MU_CONFIG.maxnum,
+		 "number of completions to show (with --complete)", "<number>"},
 		{NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL}
 	};
 
@@ -459,6 +467,12 @@ config_options_group_server ()
 		 "list the available command and their parameters, then exit", NULL},
                 {"eval", 'e', G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_STRING,
                  &MU_CONFIG.eval, "expression to evaluate", "<expr>"},
+		{"format", 'o', 0, G_OPTION_ARG_STRING, &MU_CONFIG.formatstr,
+		 "output format ('sexp'(*), 'json')", "<format>"},
+		{"readable-max-age", 0, 0, G_OPTION_ARG_INT,
+		 &MU_CONFIG.readable_max_age,
+		 "for find with :skip-unreadable, re-use directory listings "
+		 "for this long (default: 0, check each message)", "<seconds>"},
 		{NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL}
 	};
 
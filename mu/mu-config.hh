@@ -135,11 +135,16 @@ struct _MuConfig {
 	gchar		*formatstr;     /* output type for find
 					 * (plain,links,xml,json,sexp)
 					 * and view (plain, sexp) and cfind
+					 * and server (sexp, json)
 					 */
 	MuConfigFormat   format;        /* the decoded formatstr */
 	gchar		*exec;		/* command to execute on the
 					 * files for the matched
 					 * messages */
+	int		 jobs;		/* max # of exec commands to
+					 * run in parallel */
+	int		 max_args;	/* max # of files per exec
+					 * command */
 	gboolean        skip_dups;        /* if there are multiple
 					 * messages with the same
 					 * msgid, show only the first
@@ -166,6 +171,7 @@ struct _MuConfig {
 
 	/* options for cfind (and 'find' --> "after") */
 	gboolean          personal;       /* only show 'personal' addresses */
+	gboolean          complete;       /* the pattern is a prefix to complete */
 	/* also 'after' --> see above */
 
 	/* output to a maildir with symlinks */
@@ -186,6 +192,8 @@ struct _MuConfig {
 	gboolean        commands;        /* dump documentations for server
 					  * commands */
         gchar          *eval;            /* command to evaluate */
+	int             readable_max_age; /* seconds to re-use directory
+					   * listings for :skip-unreadable */
 
         /* options for mu-script */
 	gchar           *script;         /* script to run */
@@ -330,6 +330,58 @@ test_mu_cfind_csv (void)
 	g_free (erroutput);
 }
 
+static void
+test_mu_cfind_json (void)
+{
+	gchar *cmdline, *output, *erroutput;
+
+	cmdline = g_strdup_printf ("%s cfind --muhome=%s --format=json "
+				   "'testmu\\.xxx?'",
+				   MU_PROGRAM, CONTACTS_CACHE);
+
+	if (g_test_verbose())
+		g_print("%s\n", cmdline);
+
+	output = erroutput = NULL;
+	g_assert (g_spawn_command_line_sync (cmdline, &output, &erroutput,
+					     NULL, NULL));
+	g_assert (output);
+	g_assert_true (g_str_has_prefix (output, "[\n  {"));
+	g_assert_true (g_str_has_suffix (output, "}\n]\n"));
+	g_assert_nonnull (strstr (output, "\"email\":\"hk@testmu.xxx\","
+				  "\"name\":\"Helmut Kröger\""));
+	g_assert_nonnull (strstr (output, "\"email\":\"testmu@testmu.xx\","
+				  "\"name\":\"Mü\""));
+	g_assert_nonnull (strstr (output, "},\n  {"));
+
+	g_free (cmdline);
+	g_free (output);
+	g_free (erroutput);
+}
+
+/* --personal only shows the personal contacts; there are none in our store, as
+ * we did not pass any --my-address to 'mu init' */
+static void
+test_mu_cfind_personal (void)
+{
+	gchar *cmdline, *output, *erroutput;
+
+	cmdline = g_strdup_printf ("%s cfind --muhome=%s --personal "
+				   "'testmu\\.xxx?'",
+				   MU_PROGRAM, CONTACTS_CACHE);
+	if (g_test_verbose())
+		g_print ("%s\n", cmdline);
+
+	output = erroutput = NULL;
+	g_assert (g_spawn_command_line_sync (cmdline, &output, &erroutput,
+					     NULL, NULL));
+	g_assert_cmpstr (output, ==, "");
+
+	g_free (cmdline);
+	g_free (output);
+	g_free (erroutput);
+}
+
 
 int
 main (int argc, char *argv[])
@@ -353,6 +405,10 @@ main (int argc, char *argv[])
 			 test_mu_cfind_org_contact);
 	g_test_add_func ("/mu-cmd-cfind/test-mu-cfind-csv",
 			 test_mu_cfind_csv);
+	g_test_add_func ("/mu-cmd-cfind/test-mu-cfind-json",
+			 test_mu_cfind_json);
+	g_test_add_func ("/mu-cmd-cfind/test-mu-cfind-personal",
+			 test_mu_cfind_personal);
 
 	g_log_set_handler (NULL,
 			   (GLogLevelFlags)(
@@ -28,6 +28,7 @@
 
 #include <stdlib.h>
 #include <unistd.h>
+#include <sys/wait.h>
 #include <string.h>
 
 #include "test-mu-common.hh"
@@ -149,6 +150,47 @@ test_mu_find_01 (void)
 }
 
 
+/* with --exec, each command prints one line for the messages it gets */
+static void
+test_mu_find_exec (void)
+{
+	const char *query = "f:soc@example.com OR f:john OR t:edmond";
+	char *args;
+
+	args = g_strdup_printf ("--exec=echo %s", query);
+	search (args, 3);
+	g_free (args);
+
+	args = g_strdup_printf ("--exec=echo --max-args=2 --jobs=2 %s", query);
+	search (args, 2);
+	g_free (args);
+
+	args = g_strdup_printf ("--exec=echo --max-args=10 %s", query);
+	search (args, 1);
+	g_free (args);
+}
+
+/* plain output, straight from the fields */
+static void
+test_mu_find_fields (void)
+{
+	gchar *cmdline, *output, *erroutput;
+
+	cmdline = g_strdup_printf ("%s find --muhome=%s --fields='m|s|p' s:dude",
+				   MU_PROGRAM, DBPATH);
+	if (g_test_verbose())
+		g_printerr ("\n$ %s\n", cmdline);
+
+	g_assert (g_spawn_command_line_sync (cmdline,
+					     &output, &erroutput,
+					     NULL, NULL));
+	g_assert_cmpstr (output, ==, "/bar|rock on dude|normal\n");
+
+	g_free (output);
+	g_free (erroutput);
+	g_free (cmdline);
+}
+
 /* index testdir2, and make sure it adds two documents */
 static void
 test_mu_find_02 (void)
@@ -851,6 +893,247 @@ test_mu_verify_bad (void)
 
 
 
+/* run the server for a single command; return its output, and (if there is
+ * one) the :tstamp of the contacts response */
+static gchar*
+server_eval (const char *sexp, gchar **tstamp)
+{
+	gchar *cmdline, *quoted, *output;
+	const char *start, *end;
+	int retval;
+
+	quoted  = g_shell_quote (sexp);
+	cmdline = g_strdup_printf ("%s server --muhome=%s --eval=%s",
+				   MU_PROGRAM, DBPATH, quoted);
+	if (g_test_verbose())
+		g_print ("$ %s\n", cmdline);
+
+	output = NULL;
+	g_assert (g_spawn_command_line_sync (cmdline, &output, NULL,
+					     &retval, NULL));
+	g_assert_cmpuint (retval, ==, 0);
+
+	if (tstamp) {
+		start = strstr (output, ":tstamp \"");
+		g_assert (start);
+		start += strlen (":tstamp \"");
+		end = strchr (start, '"');
+		g_assert (end);
+		*tstamp = g_strndup (start, end - start);
+	}
+
+	g_free (quoted);
+	g_free (cmdline);
+
+	return output;
+}
+
+static unsigned
+count_substr (const char *str, const char *substr)
+{
+	unsigned n;
+
+	for (n = 0; (str = strstr (str, substr)); ++n)
+		str += strlen (substr);
+
+	return n;
+}
+
+/* the contacts :tstamp lets the server send only what changed; but a tstamp
+ * from another store (or from the future) gets everything */
+static void
+test_mu_server_contacts_tstamp (void)
+{
+	gchar *output, *tstamp, *tstamp2, *sexp;
+	unsigned all;
+
+	output = server_eval ("(contacts)", &tstamp);
+	all = count_substr (output, ":address");
+	g_assert_cmpuint (all, >, 0);
+	g_assert (strchr (tstamp, ':'));
+	g_free (output);
+
+	/* nothing changed since */
+	sexp = g_strdup_printf ("(contacts :tstamp \"%s\")", tstamp);
+	output = server_eval (sexp, &tstamp2);
+	g_assert_cmpuint (count_substr (output, ":address"), ==, 0);
+	g_assert_cmpstr (tstamp, ==, tstamp2);
+	g_free (tstamp2);
+	g_free (output);
+	g_free (sexp);
+
+	/* some other store (generation) */
+	sexp = g_strdup_printf ("(contacts :tstamp \"1%s\")", tstamp);
+	output = server_eval (sexp, NULL);
+	g_assert_cmpuint (count_substr (output, ":address"), ==, all);
+	g_free (output);
+	g_free (sexp);
+
+	/* a sequence number from the future */
+	output = server_eval ("(contacts :tstamp \"999999999\")", NULL);
+	g_assert_cmpuint (count_substr (output, ":address"), ==, all);
+	g_free (output);
+
+	g_free (tstamp);
+}
+
+
+/* count the responses of the server output; for the s-expressions, we split
+ * the output in the length-prefixed frames, like mu4e does; for JSON, each
+ * line is a response. */
+static unsigned
+count_server_responses (const GString *output, gboolean json,
+			unsigned *found, unsigned *headers)
+{
+	const char *cur, *end;
+	unsigned n;
+
+	cur = output->str;
+	end = output->str + output->len;
+	n = *found = *headers = 0;
+
+	while (cur < end) {
+		const char *frame;
+		size_t len;
+
+		if (json) {
+			const char *eol;
+			eol = (const char*)memchr (cur, '\n', end - cur);
+			g_assert (eol);
+			frame = cur;
+			len   = eol - cur + 1;
+		} else {
+			char *post;
+			g_assert_cmpint (*cur, ==, '\376');
+			len   = strtoul (cur + 1, &post, 16);
+			g_assert_cmpint (*post, ==, '\377');
+			frame = post + 1;
+			g_assert (frame + len <= end);
+		}
+
+		if (g_strstr_len (frame, len, ":found"))
+			++*found;
+		else if (g_strstr_len (frame, len, ":docid"))
+			++*headers;
+
+		cur = frame + len;
+		++n;
+	}
+
+	return n;
+}
+
+/* read server output until there is a (further) :found response; return the
+ * offset just after it */
+static gsize
+read_until_found (int outfd, GString *output, gsize from)
+{
+	char buf[64 * 1024];
+	const char *found;
+	ssize_t n;
+
+	while (!(found = g_strstr_len (output->str + from, output->len - from,
+				       ":found"))) {
+		n = read (outfd, buf, sizeof(buf));
+		if (n < 0 && errno == EINTR)
+			continue;
+		g_assert_cmpint (n, >, 0);
+		g_string_append_len (output, buf, n);
+	}
+
+	return found - output->str + strlen (":found");
+}
+
+/* measure the end-to-end throughput of 'find' over a pipe, for the given
+ * format. A newer find cancels the running one, so we wait for each :found
+ * before sending the next find. */
+static void
+bench_server_find (gboolean json)
+{
+	const unsigned rounds = 200;
+	gchar *muhome, *argv[5], *cmd;
+	GString *output;
+	GTimer *timer;
+	GPid pid;
+	int infd, outfd, status;
+	unsigned u, found, headers;
+	char buf[64 * 1024];
+	ssize_t n;
+	gsize seen;
+	double secs;
+
+	muhome  = g_strdup_printf ("--muhome=%s", DBPATH);
+	argv[0] = (gchar*)MU_PROGRAM;
+	argv[1] = (gchar*)"server";
+	argv[2] = muhome;
+	argv[3] = (gchar*)(json ? "--format=json" : "--format=sexp");
+	argv[4] = NULL;
+
+	timer = g_timer_new ();
+	g_assert (g_spawn_async_with_pipes (NULL, argv, NULL,
+					    G_SPAWN_DO_NOT_REAP_CHILD |
+					    G_SPAWN_STDERR_TO_DEV_NULL,
+					    NULL, NULL, &pid,
+					    &infd, &outfd, NULL, NULL));
+
+	output = g_string_sized_new (sizeof(buf));
+	for (u = seen = 0; u != rounds; ++u) {
+		cmd = g_strdup_printf ("(find :query \"\" :maxnum -1 "
+				       ":request-id %u)\n", u + 1);
+		g_assert_cmpint (write (infd, cmd, strlen (cmd)), ==,
+				 (ssize_t)strlen (cmd));
+		g_free (cmd);
+		seen = read_until_found (outfd, output, seen);
+	}
+
+	g_assert_cmpint (write (infd, "(quit)\n", 7), ==, 7);
+	close (infd);
+
+	while ((n = read (outfd, buf, sizeof(buf))) != 0) {
+		if (n < 0 && errno == EINTR)
+			continue;
+		g_assert_cmpint (n, >, 0);
+		g_string_append_len (output, buf, n);
+	}
+	close (outfd);
+
+	g_assert_cmpint (waitpid (pid, &status, 0), ==, pid);
+	g_spawn_close_pid (pid);
+
+	/* skip the welcome message */
+	if (!json)
+		while (output->len > 0 && output->str[0] == ';')
+			g_string_erase (output, 0,
+					strchr (output->str, '\n') - output->str + 1);
+
+	count_server_responses (output, json, &found, &headers);
+	secs = g_timer_elapsed (timer, NULL);
+
+	g_assert_cmpuint (found, ==, rounds);
+	g_assert_cmpuint (headers, ==, rounds * 13);
+
+	g_test_minimized_result (secs, "%s: %u headers (%" G_GSIZE_FORMAT
+				 " bytes) in %.3fs, %.0f headers/s",
+				 json ? "json" : "sexp", headers, output->len,
+				 secs, headers / secs);
+
+	g_timer_destroy (timer);
+	g_string_free (output, TRUE);
+	g_free (muhome);
+}
+
+static void
+bench_server_find_sexp (void)
+{
+	bench_server_find (FALSE);
+}
+
+static void
+bench_server_find_json (void)
+{
+	bench_server_find (TRUE);
+}
+
 int
 main (int argc, char *argv[])
 {
@@ -866,6 +1149,8 @@ main (int argc, char *argv[])
 			 test_mu_find_empty_query);
 	g_test_add_func ("/mu-cmd/test-mu-find-01", test_mu_find_01);
 	g_test_add_func ("/mu-cmd/test-mu-find-02", test_mu_find_02);
+	g_test_add_func ("/mu-cmd/test-mu-find-exec", test_mu_find_exec);
+	g_test_add_func ("/mu-cmd/test-mu-find-fields", test_mu_find_fields);
 
 	g_test_add_func ("/mu-cmd/test-mu-find-file", test_mu_find_file);
 	g_test_add_func ("/mu-cmd/test-mu-find-mime", test_mu_find_mime);
@@ -902,6 +1187,16 @@ main (int argc, char *argv[])
 	g_test_add_func ("/mu-cmd/test-mu-verify-good",  test_mu_verify_good);
 	g_test_add_func ("/mu-cmd/test-mu-verify-bad",  test_mu_verify_bad);
 
+	g_test_add_func ("/mu-cmd/test-mu-server-contacts-tstamp",
+			 test_mu_server_contacts_tstamp);
+
+	if (g_test_perf()) {
+		g_test_add_func ("/mu-cmd/bench-server-find-sexp",
+				 bench_server_find_sexp);
+		g_test_add_func ("/mu-cmd/bench-server-find-json",
+				 bench_server_find_json);
+	}
+
 	g_log_set_handler (NULL,
 			   (GLogLevelFlags)(
 			   G_LOG_LEVEL_MASK | G_LOG_LEVEL_WARNING|
@@ -640,8 +640,10 @@ process."
      ((eq type 'add) t) ;; do nothing
      ((eq type 'index)
       (if (eq (plist-get info :status) 'running)
-          (mu4e-index-message
-           "Indexing... processed %d, updated %d" processed updated)
+          (let ((eta (plist-get info :eta)))
+            (mu4e-index-message
+             "Indexing... processed %d, updated %d%s" processed updated
+             (if eta (format " (%ds left)" eta) "")))
         (progn
           (mu4e-index-message
            "%s completed; processed %d, updated %d, cleaned-up %d"
@@ -369,7 +369,7 @@ update_model (GtkTreeStore *store, const char *xpath, const char *query,
         for (auto&& it: *res) {
                 GtkTreeIter treeiter, prev_treeiter;
 
-                const auto thread_path{it.query_match().thread_path};
+                const auto thread_path{it.query_match().thread_path.to_string()};
 
                 if (prev_thread_path.find(thread_path) == 0)
                         gtk_tree_store_append (store, &treeiter, &prev_treeiter);